@@ -0,0 +1,396 @@
+// Microbenchmarks for the shell's hot paths.
+//
+// Generates synthetic inputs in a scratch directory, runs Hshell in batch
+// mode on them and reports latency percentiles per operation. Results are
+// also written as JSON (one case per line) so runs from different commits
+// can be compared with --compare.
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+extern char **environ;
+
+struct bench_case {
+	const char *name;
+	const char *description;
+	char *script; // run with Hshell -c, or NULL to run the file in script_file
+	char script_file[4096];
+	int ops; // operations per run, latency is reported per operation
+	size_t bytes; // input bytes per run, for throughput
+	bool subtract_startup; // remove the shell's own startup time
+};
+
+struct bench_result {
+	char name[64];
+	double p50, p90, p99, min, mean; // microseconds per operation
+	double mb_per_s;
+};
+
+const char *shell_path = "./Hshell";
+char work_dir[1024];
+char path_value[65536];
+int runs = 30;
+bool quick;
+const char *filter;
+char revision[64] = "unknown"; // commit the shell was built from
+
+uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+// Function to get a deterministic pseudo-random number (xorshift64)
+uint64_t next_random(void) {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state;
+}
+
+double now_seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Function to make a path inside the scratch directory
+const char *work_path(const char *name) {
+	static char paths[8][4096];
+	static int next;
+	char *path = paths[next++ % 8];
+	snprintf(path, sizeof(paths[0]), "%s/%s", work_dir, name);
+	return path;
+}
+
+FILE *open_output(const char *name) {
+	FILE *f = fopen(work_path(name), "w");
+	if (f == NULL) {
+		fprintf(stderr, "bench: %s: %s\n", work_path(name), strerror(errno));
+		exit(1);
+	}
+	return f;
+}
+
+// Function to date a file an hour back. hdiff only keeps fingerprints of
+// files that have not been modified for a while; an aged input gets one
+// from the warm-up run instead of partway through the samples.
+void age_file(const char *name) {
+	struct timespec times[2] = {{time(NULL) - 3600, 0}, {time(NULL) - 3600, 0}};
+	utimensat(AT_FDCWD, work_path(name), times, 0);
+}
+
+// Function to write a text file of size bytes made of words from a small
+// vocabulary, and a copy with about one line in a hundred changed
+size_t generate_text(const char *name, const char *changed_name, size_t size) {
+	static const char *vocabulary[] = {
+		"the", "shell", "process", "pipe", "fork", "exec", "signal", "terminal", "job", "command",
+		"history", "prompt", "kernel", "module", "file", "directory", "buffer", "completion",
+		"a", "of", "and", "to", "in", "is", "it", "that", "for", "on", "with", "as",
+	};
+	FILE *f = open_output(name), *g = open_output(changed_name);
+	size_t written = 0;
+	char line[256];
+	while (written < size) {
+		int len = 0, words = 4 + next_random() % 10;
+		for (int i = 0; i < words; i++)
+			len += snprintf(line + len, sizeof(line) - len, "%s%s", i ? " " : "",
+							vocabulary[next_random() % (sizeof(vocabulary) / sizeof(vocabulary[0]))]);
+		line[len++] = '\n';
+		fwrite(line, 1, len, f);
+		if (next_random() % 100 == 0) line[0] = line[0] == 'x' ? 'y' : 'x';
+		fwrite(line, 1, len, g);
+		written += len;
+	}
+	fclose(f);
+	fclose(g);
+	return written;
+}
+
+// Function to write n points near a cubic for the regression command
+size_t generate_points(const char *name, int n) {
+	FILE *f = open_output(name);
+	for (int i = 0; i < n; i++) {
+		double x = i / (double)n * 10;
+		double noise = (next_random() % 1000) / 1000.0 - 0.5;
+		fprintf(f, "%f %f\n", x, 0.5 * x * x * x - 2 * x + 1 + noise);
+	}
+	long size = ftell(f);
+	fclose(f);
+	return size;
+}
+
+// Function to make dirs directories of files empty executables and put
+// them in front of PATH
+void generate_path_tree(int dirs, int files) {
+	size_t len = 0;
+	for (int d = 0; d < dirs; d++) {
+		char dir[64];
+		snprintf(dir, sizeof(dir), "path/bin%02d", d);
+		mkdir(work_path("path"), 0755);
+		mkdir(work_path(dir), 0755);
+		for (int i = 0; i < files; i++) {
+			char file[96];
+			snprintf(file, sizeof(file), "%s/tool%02d_%04d", dir, d, i);
+			int fd = open(work_path(file), O_WRONLY | O_CREAT | O_TRUNC, 0755);
+			if (fd >= 0) close(fd);
+		}
+		len += snprintf(path_value + len, sizeof(path_value) - len, "%s:", work_path(dir));
+	}
+	snprintf(path_value + len, sizeof(path_value) - len, "%s", getenv("PATH") ? getenv("PATH") : "/usr/bin:/bin");
+}
+
+// Function to write a script of n copies of line
+void generate_script(const char *name, const char *line, int n) {
+	FILE *f = open_output(name);
+	for (int i = 0; i < n; i++) fprintf(f, "%s\n", line);
+	fclose(f);
+}
+
+// Function to run the shell once on a case, returns the wall time or -1
+double run_once(struct bench_case *c) {
+	char *argv[4] = {(char *)shell_path, NULL, NULL, NULL};
+	if (c->script) {
+		argv[1] = "-c";
+		argv[2] = c->script;
+	} else {
+		argv[1] = c->script_file;
+	}
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+	posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+	posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+	double started = now_seconds();
+	pid_t pid;
+	int r = posix_spawn(&pid, shell_path, &actions, NULL, argv, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	if (r != 0) {
+		fprintf(stderr, "bench: %s: %s\n", shell_path, strerror(r));
+		exit(1);
+	}
+	int status;
+	while (waitpid(pid, &status, 0) == -1 && errno == EINTR);
+	double elapsed = now_seconds() - started;
+	return WIFEXITED(status) ? elapsed : -1;
+}
+
+int compare_doubles(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+double percentile(const double *sorted, int n, double p) {
+	double rank = p * (n - 1);
+	int low = (int)rank;
+	if (low + 1 >= n) return sorted[n - 1];
+	return sorted[low] + (rank - low) * (sorted[low + 1] - sorted[low]);
+}
+
+// Function to run a case runs times after one warm-up run
+bool run_case(struct bench_case *c, double startup, struct bench_result *result) {
+	double samples[runs];
+	if (run_once(c) < 0) { // warm-up, also fills the command index cache
+		fprintf(stderr, "bench: %s: the shell did not exit normally\n", c->name);
+		return false;
+	}
+	for (int i = 0; i < runs; i++) {
+		double t = run_once(c);
+		if (t < 0) {
+			fprintf(stderr, "bench: %s: the shell did not exit normally\n", c->name);
+			return false;
+		}
+		if (c->subtract_startup) t = t > startup ? t - startup : 0;
+		samples[i] = t / c->ops * 1e6;
+	}
+	qsort(samples, runs, sizeof(double), compare_doubles);
+	snprintf(result->name, sizeof(result->name), "%s", c->name);
+	result->p50 = percentile(samples, runs, 0.50);
+	result->p90 = percentile(samples, runs, 0.90);
+	result->p99 = percentile(samples, runs, 0.99);
+	result->min = samples[0];
+	result->mean = 0;
+	for (int i = 0; i < runs; i++) result->mean += samples[i] / runs;
+	result->mb_per_s = c->bytes && result->p50 > 0 ? c->bytes / result->p50 : 0; // bytes per us = MB/s
+	return true;
+}
+
+// Function to read the results of an earlier run, returns how many were read
+int load_results(const char *file, struct bench_result *results, int max) {
+	FILE *f = fopen(file, "r");
+	if (f == NULL) {
+		fprintf(stderr, "bench: %s: %s\n", file, strerror(errno));
+		return 0;
+	}
+	char line[1024];
+	int n = 0;
+	while (n < max && fgets(line, sizeof(line), f)) {
+		struct bench_result *r = &results[n];
+		if (sscanf(line, " {\"name\": \"%63[^\"]\", \"p50_us\": %lf, \"p90_us\": %lf, \"p99_us\": %lf, "
+				   "\"min_us\": %lf, \"mean_us\": %lf, \"mb_per_s\": %lf",
+				   r->name, &r->p50, &r->p90, &r->p99, &r->min, &r->mean, &r->mb_per_s) == 7)
+			n++;
+	}
+	fclose(f);
+	return n;
+}
+
+void write_results(const char *file, struct bench_result *results, int n) {
+	FILE *f = fopen(file, "w");
+	if (f == NULL) {
+		fprintf(stderr, "bench: %s: %s\n", file, strerror(errno));
+		return;
+	}
+	fprintf(f, "{\"revision\": \"%s\", \"time\": %ld, \"runs\": %d, \"results\": [\n", revision, (long)time(NULL), runs);
+	for (int i = 0; i < n; i++)
+		fprintf(f, "  {\"name\": \"%s\", \"p50_us\": %.3f, \"p90_us\": %.3f, \"p99_us\": %.3f, "
+				"\"min_us\": %.3f, \"mean_us\": %.3f, \"mb_per_s\": %.2f}%s\n",
+				results[i].name, results[i].p50, results[i].p90, results[i].p99,
+				results[i].min, results[i].mean, results[i].mb_per_s, i + 1 < n ? "," : "");
+	fprintf(f, "]}\n");
+	fclose(f);
+}
+
+int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+	(void)st; (void)flag; (void)ftw;
+	return remove(path);
+}
+
+void usage(void) {
+	fprintf(stderr, "usage: bench [--shell PATH] [--runs N] [--quick] [--only NAME]\n"
+					"             [--out FILE] [--compare FILE]\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[]) {
+	const char *out = NULL, *baseline = NULL;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--shell") == 0 && i + 1 < argc) shell_path = argv[++i];
+		else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) runs = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) out = argv[++i];
+		else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc) baseline = argv[++i];
+		else if (strcmp(argv[i], "--only") == 0 && i + 1 < argc) filter = argv[++i];
+		else if (strcmp(argv[i], "--quick") == 0) quick = true;
+		else usage();
+	}
+	if (runs < 1) usage();
+	char *resolved = realpath(shell_path, NULL);
+	if (resolved == NULL) {
+		fprintf(stderr, "bench: %s: %s\n", shell_path, strerror(errno));
+		return 1;
+	}
+	shell_path = resolved;
+	char out_path[4096];
+	if (out && out[0] != '/') { // the benchmarks run inside the scratch directory
+		char cwd[2048];
+		snprintf(out_path, sizeof(out_path), "%s/%s", getcwd(cwd, sizeof(cwd)) ? cwd : ".", out);
+		out = out_path;
+	}
+
+	FILE *git = popen("git rev-parse --short HEAD 2>/dev/null", "r");
+	if (git) {
+		if (fgets(revision, sizeof(revision), git)) revision[strcspn(revision, "\n")] = '\0';
+		pclose(git);
+	}
+	struct bench_result results[64], previous[64];
+	int result_count = 0, previous_count = baseline ? load_results(baseline, previous, 64) : 0;
+
+	const char *tmp = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+	snprintf(work_dir, sizeof(work_dir), "%s/hshell-bench.XXXXXX", tmp);
+	if (mkdtemp(work_dir) == NULL) {
+		fprintf(stderr, "bench: %s: %s\n", work_dir, strerror(errno));
+		return 1;
+	}
+
+	// inputs
+	size_t text_size = quick ? 1 << 20 : 16 << 20;
+	int points = quick ? 10000 : 200000;
+	printf("generating inputs in %s\n", work_dir);
+	size_t text_bytes = generate_text("words.txt", "words2.txt", text_size);
+	age_file("words.txt");
+	age_file("words2.txt");
+	size_t point_bytes = generate_points("points.txt", points);
+	generate_path_tree(quick ? 16 : 64, quick ? 100 : 400);
+	int lines = quick ? 200 : 1000;
+	generate_script("launch.hs", "/bin/true", lines / 10);
+	generate_script("lookup.hs", "true", lines / 10);
+	generate_script("parse.hs", ": alpha \"beta gamma\" 'delta epsilon' zeta\\ eta --flag=value -x -y -z "
+					"theta iota kappa lambda 'mu nu' xi \"omicron pi\" rho sigma", lines * 10);
+	generate_script("complete.hs", "compgen -c tool1", lines);
+	generate_script("empty.hs", "", 1);
+
+	// the shell finds the scratch PATH tree and keeps its index cache there
+	setenv("PATH", path_value, 1);
+	setenv("HOME", work_dir, 1);
+	setenv("XDG_CACHE_HOME", work_path("cache"), 1);
+	if (chdir(work_dir) == -1) return 1;
+
+	char pipeline[8192], hdiff_a[8192], hdiff_b[8192], hdiff_a_cached[8192], hdiff_b_cached[8192], letters[8192], words[8192], all[8192], regression[8192];
+	snprintf(pipeline, sizeof(pipeline), "cat words.txt | cat | cat > /dev/null");
+	snprintf(hdiff_a, sizeof(hdiff_a), "hdiff -a -nocache words.txt words2.txt");
+	snprintf(hdiff_b, sizeof(hdiff_b), "hdiff -b -nocache words.txt words2.txt");
+	snprintf(hdiff_a_cached, sizeof(hdiff_a_cached), "hdiff -a words.txt words2.txt");
+	snprintf(hdiff_b_cached, sizeof(hdiff_b_cached), "hdiff -b words.txt words2.txt");
+	snprintf(letters, sizeof(letters), "textify words.txt -count_letters");
+	snprintf(words, sizeof(words), "textify words.txt -count_words");
+	snprintf(all, sizeof(all), "textify words.txt -count_all");
+	snprintf(regression, sizeof(regression), "regression points.txt -p 3");
+
+	struct bench_case cases[] = {
+		{"startup", "shell start and exit", NULL, "", 1, 0, false},
+		{"launch", "run /bin/true", NULL, "", lines / 10, 0, true},
+		{"lookup", "run true through PATH", NULL, "", lines / 10, 0, true},
+		{"parse", "parse a long builtin line", NULL, "", lines * 10, 0, true},
+		{"complete", "complete a command prefix", NULL, "", lines, 0, true},
+		{"pipeline", "cat | cat | cat over the text", pipeline, "", 1, text_bytes, true},
+		{"hdiff_lines", "hdiff -a on the text, no fingerprints", hdiff_a, "", 1, text_bytes, true},
+		{"hdiff_bytes", "hdiff -b on the text, no fingerprints", hdiff_b, "", 1, text_bytes, true},
+		{"hdiff_lines_cached", "hdiff -a on the text, stored fingerprints", hdiff_a_cached, "", 1, text_bytes, true},
+		{"hdiff_bytes_cached", "hdiff -b on the text, stored fingerprints", hdiff_b_cached, "", 1, text_bytes, true},
+		{"textify_letters", "textify -count_letters", letters, "", 1, text_bytes, true},
+		{"textify_words", "textify -count_words", words, "", 1, text_bytes, true},
+		{"textify_all", "textify -count_all", all, "", 1, text_bytes, true},
+		{"regression", "cubic regression", regression, "", 1, point_bytes, true},
+	};
+	const char *scripts[] = {"empty.hs", "launch.hs", "lookup.hs", "parse.hs", "complete.hs"};
+	for (size_t i = 0; i < sizeof(scripts) / sizeof(scripts[0]); i++)
+		snprintf(cases[i].script_file, sizeof(cases[i].script_file), "%s", work_path(scripts[i]));
+	int case_count = sizeof(cases) / sizeof(cases[0]);
+
+	double startup = 0;
+
+	printf("%-18s %12s %12s %12s %12s %10s%s\n", "case", "p50 us", "p90 us", "p99 us", "min us", "MB/s",
+		   previous_count ? "  vs base" : "");
+	for (int i = 0; i < case_count; i++) {
+		struct bench_case *c = &cases[i];
+		if (i > 0 && filter && strstr(c->name, filter) == NULL) continue; // startup is always needed
+		struct bench_result *r = &results[result_count];
+		if (!run_case(c, startup, r)) continue;
+		result_count++;
+		if (i == 0) startup = r->p50 / 1e6;
+		printf("%-18s %12.2f %12.2f %12.2f %12.2f", r->name, r->p50, r->p90, r->p99, r->min);
+		if (r->mb_per_s > 0) printf(" %10.1f", r->mb_per_s);
+		else printf(" %10s", "-");
+		for (int j = 0; j < previous_count; j++) {
+			if (strcmp(previous[j].name, r->name) != 0 || previous[j].p50 <= 0) continue;
+			printf("  %+6.1f%%", (r->p50 - previous[j].p50) / previous[j].p50 * 100);
+		}
+		printf("  %s\n", c->description);
+		fflush(stdout);
+	}
+
+	if (out) {
+		write_results(out, results, result_count);
+		printf("results written to %s\n", out);
+	}
+	nftw(work_dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+	return 0;
+}
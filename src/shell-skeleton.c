@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -15,6 +16,25 @@
 
 #include <math.h>
 #include <float.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <inttypes.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#include <pwd.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/uio.h>
 
 const char *sysname = "Hshell";
 
@@ -25,30 +45,307 @@ enum return_codes {
 	UNKNOWN = 2,
 };
 
+// How external commands are started
+enum launch_modes {
+	LAUNCH_SPAWN = 0, // posix_spawn, which vforks without copying the page tables
+	LAUNCH_FORK = 1, // full fork of the shell followed by execv
+};
+
+enum redirect_kinds {
+	REDIRECT_IN = 0, // [n]<file
+	REDIRECT_OUT = 1, // [n]>file
+	REDIRECT_APPEND = 2, // [n]>>file
+	REDIRECT_DUP = 3, // [n]>&m or [n]<&m
+};
+
+struct redirect_t {
+	int fd; // descriptor of the command being redirected
+	int kind;
+	char *target; // file name, unless kind is REDIRECT_DUP
+	int dup_fd; // descriptor copied for REDIRECT_DUP
+	struct redirect_t *next; // applied in order
+};
+
 struct command_t {
 	char *name;
 	bool background;
 	bool auto_complete;
 	int arg_count;
 	char **args;
+	struct redirect_t *redirects;
+	bool timed; // run under the time prefix
 	struct command_t *next; // for piping
 };
 
+#define ARENA_CHUNK 16384
+
+// Bump allocator chunk; a command line's nodes, vectors and strings all live in chunks
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	size_t used;
+	char data[];
+};
+
+struct arena {
+	struct arena_chunk *head; // chunk allocations are served from
+};
+
+struct arena line_arena; // everything parsed from the current command line
+
+#define HISTORY_MAX 1048576 // entries kept searchable
+
+// Command history. The history file is an append-only log of lines that
+// every shell appends to with single O_APPEND writes; it is mapped read-only
+// and a ring of entry offsets indexes its newest HISTORY_MAX lines.
+struct history {
+	char path[4096];
+	int enabled;
+	char *map;
+	size_t map_len;
+	dev_t dev;
+	ino_t ino;
+	size_t indexed; // bytes of the file split into entries so far
+	uint64_t *offsets; // ring: file offset of entry n is offsets[n % HISTORY_MAX]
+	uint64_t *signatures; // ring: bigram masks for reverse search, 0 until computed
+	size_t capacity; // allocated ring slots, grows up to HISTORY_MAX
+	uint64_t total; // entries indexed, i.e. lines in the file
+	uint64_t cursor; // entry shown by the arrow keys, total for the line being typed
+	char *saved; // the line being typed while browsing
+	size_t saved_len;
+};
+
+struct history history;
+
+// Line editor. The line is a gap buffer: text before the cursor is at
+// [0, gap_start), text after it at [gap_end, capacity), so an edit at the
+// cursor moves no other bytes. Input is read in bulk and all output of one
+// batch of keys is collected in out and written once.
+struct line_editor {
+	char *text;
+	size_t gap_start, gap_end, capacity;
+	char *out; // pending terminal output
+	size_t out_len, out_cap;
+	char in[4096]; // bytes read from the terminal but not handled yet
+	size_t in_len, in_pos;
+	bool dirty; // the whole line has to be drawn again
+	bool searching; // Ctrl+R owns the line
+	size_t view; // first line byte shown when the line is wider than the terminal
+	int columns;
+	char prompt[2200];
+	size_t prompt_len;
+	bool have_termios;
+	struct termios cooked, raw;
+};
+
+struct line_editor editor;
+
+// Prompt segments. Each one is formatted once and kept until its trigger
+// invalidates it: cd for the directory, a changed value for the status, job
+// count and duration. The git branch needs file reads, so a worker thread
+// finds it and wakes the editor through ready_fd.
+enum prompt_segments {
+	SEGMENT_USER, SEGMENT_HOST, SEGMENT_CWD, SEGMENT_GIT,
+	SEGMENT_JOBS, SEGMENT_DURATION, SEGMENT_STATUS, SEGMENT_COUNT
+};
+
+struct prompt_cache {
+	char text[SEGMENT_COUNT][1024];
+	size_t len[SEGMENT_COUNT];
+	bool valid[SEGMENT_COUNT];
+	int status, jobs; // values the cached segments show
+	double duration, last_duration; // seconds the last foreground command took
+	pthread_mutex_t lock; // guards the git segment and the worker request
+	pthread_cond_t wake;
+	bool worker_started;
+	uint64_t requested, computed; // git requests, so a stale answer is dropped
+	char git_dir[1024]; // directory the worker looks from
+	int ready_fd; // eventfd, readable when the git segment changed
+};
+
+struct prompt_cache prompt_cache = {
+	.lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER, .ready_fd = -1,
+};
+
 struct autocomplete_struct {
 	char **matches; // matchings
 	int count; // matching count
+	bool borrowed; // matches point into an index and must not be freed
+	int stem_len; // length of the input already covered by each match
+};
+
+#define DIR_SNAPSHOTS 8
+
+// Sorted listing of one directory, reused while (dev, inode, mtime) is unchanged
+struct dir_snapshot {
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	char *arena; // entry names, directories carry a trailing '/'
+	char **names; // sorted views into the arena
+	int count;
+	unsigned long last_used;
+};
+
+struct dir_snapshot dir_snapshots[DIR_SNAPSHOTS];
+unsigned long dir_snapshot_clock;
+
+// Sorted, duplicate free list of command names used for completion
+struct command_index {
+	char *arena; // names stored back to back, NUL terminated
+	size_t arena_len;
+	char **names; // sorted views into the arena
+	int count;
+	int capacity; // allocated slots of names
+	void *map; // cache file mapping holding the arena, if loaded from disk
+	size_t map_len;
+	char **extra; // names added by inotify after the index was built
+	int extra_count;
 };
 
+#define INDEX_MAGIC "HSHIDX1"
+#define INDEX_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB)
+
+// Layout of the cache file: header, one stamp per PATH directory, the PATH
+// value, sorted name offsets and finally the name arena
+struct index_header {
+	char magic[8];
+	uint32_t dir_count;
+	uint32_t name_count;
+	uint64_t path_len;
+	uint64_t arena_len;
+};
+
+struct index_stamp {
+	int64_t sec; // mtime of the directory, -1 if it did not exist
+	int64_t nsec;
+};
+
+// Background rebuild of the command index
+struct index_builder {
+	pthread_t thread;
+	bool running;
+	int done; // set by the builder thread once result is complete
+	char *path_value;
+	struct command_index result;
+};
+
+enum job_states {
+	JOB_RUNNING = 0,
+	JOB_STOPPED = 1,
+	JOB_DONE = 2,
+};
+
+// A pipeline started by the shell, kept until its completion is reported
+struct job {
+	int id; // the n of %n
+	pid_t pgid;
+	pid_t *pids; // one per stage
+	int stage_count;
+	int alive; // stages not reaped yet
+	int state;
+	int status; // wait status of the last stage
+	struct rusage usage; // summed over the reaped stages
+	double started, finished; // monotonic seconds
+	char *command_line;
+	char **stage_names;
+	struct rusage *stage_usage; // one per stage, from wait4
+	double *stage_finished;
+	bool timed; // report the usage when it finishes
+};
+
+struct job **jobs;
+int job_count;
+unsigned long jobs_started; // lets the time prefix tell whether a job ran
+
+#define HSTATS_BUCKETS 16 // wall time histogram: <1ms, then doubling up to 16s and more
+
+// Resources used by all runs of one command name in this session
+struct command_stats {
+	char *name;
+	unsigned long count;
+	double wall, user, sys, max_wall;
+	long max_rss; // KiB
+	long voluntary, involuntary; // context switches
+	unsigned long histogram[HSTATS_BUCKETS];
+};
+
+struct command_stats *command_stats;
+int command_stats_count;
+int sigchld_fd = -1; // SIGCHLD is blocked and read from here instead
+int last_status; // exit status of the last foreground command
+
+bool shell_interactive; // stdin is a terminal the shell hands to foreground jobs
+pid_t shell_pgid;
+int launch_mode = LAUNCH_SPAWN;
+
+struct command_index cmd_index;
+bool cmd_index_loaded; // batch mode loads it on first use
+struct index_builder index_builder;
+int index_inotify_fd = -1;
+char **index_watch_dirs; // PATH directory of each inotify watch descriptor
+int index_watch_count;
+bool index_changed_during_build;
+
 char *builtin_command_list[] = {"hdiff", "regression", "psvis", "textify"};
 
+#define HASH_BUCKETS 256
+
+// Cached resolution of a command name to its path under $PATH
+struct hash_entry {
+	char *name;
+	char *path; // resolved executable path
+	int dir_index; // index of the PATH directory the path lives in
+	int hits;
+	struct hash_entry *next;
+};
+
+// A PATH directory together with the mtime its cached entries were taken at
+struct hash_dir {
+	char *dir;
+	struct timespec mtime;
+	bool stamped;
+};
+
+struct hash_entry *hash_table[HASH_BUCKETS];
+struct hash_dir *hash_dirs; // PATH split into directories
+int hash_dir_count;
+char *hash_path_value; // PATH value the table was built for
+
 void search_and_run_command(struct command_t *command, int issudo);
+const char *hash_lookup(const char *name);
+void hash_reset(void);
+int hash_builtin(struct command_t *command);
+int hstats_builtin(struct command_t *command);
+void record_command_stats(const char *name, double wall, struct rusage *usage);
+void print_job_usage(struct job *job);
+void print_usage(const char *label, double wall, struct rusage *usage);
+int compgen_builtin(struct command_t *command);
 int pipe_function(struct command_t *command);
+void run_stage(struct command_t *command, const char *path);
+int launcher_builtin(struct command_t *command);
+void reset_child_signals(void);
+bool is_parent_builtin(const char *name);
+int run_builtin_redirected(struct command_t *command);
+int process_command(struct command_t *command);
+struct job *add_job(struct command_t *command, pid_t pgid, pid_t *pids, int stage_count);
+void wait_for_job(struct job *job);
+void reap_jobs(void);
+void notify_jobs(bool report);
+int jobs_builtin(struct command_t *command);
+int wait_builtin(struct command_t *command);
+int fg_builtin(struct command_t *command);
+int bg_builtin(struct command_t *command);
+int kill_builtin(struct command_t *command);
+double now_seconds(void);
 void hdiff(struct command_t *command);
 void regressionAndPlot(struct command_t *command);
 void textify(struct command_t *command);
-void save_available_commands(const char *file_name);
+void meter(struct command_t *command);
+void save_available_commands(void);
 void combine_paths(char *result, const char *directory, const char *file);
 struct autocomplete_struct *command_complete(const char *input_str);
+void command_index_poll(void);
 struct autocomplete_struct *directory_complete(const char *input_str);
 int check_command_or_filename(char *buf, char *filename_start);
 
@@ -75,29 +372,56 @@ void print_command(struct command_t *command) {
 	}
 }
 
+// Function to allocate from an arena, adding a chunk when the current one is full
+void *arena_alloc(struct arena *arena, size_t size) {
+	size = (size + 15) & ~(size_t)15;
+	struct arena_chunk *chunk = arena->head;
+	if (chunk == NULL || chunk->used + size > chunk->size) {
+		size_t chunk_size = chunk ? chunk->size * 2 : ARENA_CHUNK;
+		if (chunk_size < size) chunk_size = size;
+		chunk = malloc(sizeof(struct arena_chunk) + chunk_size);
+		chunk->next = arena->head;
+		chunk->size = chunk_size;
+		chunk->used = 0;
+		arena->head = chunk;
+	}
+	void *memory = chunk->data + chunk->used;
+	chunk->used += size;
+	return memory;
+}
+
+// Function to empty an arena; the newest (largest) chunk is kept for reuse
+void arena_reset(struct arena *arena) {
+	if (arena->head == NULL) return;
+	struct arena_chunk *older = arena->head->next;
+	while (older) { // only present after a line outgrew the chunk
+		struct arena_chunk *next = older->next;
+		free(older);
+		older = next;
+	}
+	arena->head->next = NULL;
+	arena->head->used = 0;
+}
+
 /**
  * Release allocated memory of a command
+ * Every node, argument vector and string of the line is in line_arena,
+ * so this is a single reset rather than a walk over the pipeline
  * @param  command [description]
  * @return         [description]
  */
 int free_command(struct command_t *command) {
-	if (command->arg_count) {
-		for (int i = 0; i < command->arg_count; ++i)
-			free(command->args[i]);
-		free(command->args);
-	}
-
-	if (command->next) {
-		free_command(command->next);
-		command->next = NULL;
-	}
-
-	free(command->name);
-	free(command);
+	(void)command;
+	arena_reset(&line_arena);
 	return 0;
 }
 
 int free_autocomplete_struct(struct autocomplete_struct *match) {
+	if (match->borrowed) {
+		match->matches = NULL;
+		match->count = 0;
+		return 0;
+	}
 	if (match->count){
 		for (int i = 0; i < match->count; ++i){
 		free(match->matches[i]);
@@ -109,314 +433,919 @@ int free_autocomplete_struct(struct autocomplete_struct *match) {
 	return 0;
 }
 
+// Function to read the branch of the git repository containing dir into
+// branch, empty when dir is not inside one
+void git_branch(const char *dir, char *branch, size_t size) {
+	char path[1100], head[1024];
+	snprintf(path, sizeof(path), "%s", dir);
+	branch[0] = '\0';
+	while (1) {
+		size_t len = strlen(path);
+		snprintf(path + len, sizeof(path) - len, "/.git");
+		FILE *f = NULL;
+		struct stat st;
+		if (stat(path, &st) == 0) {
+			if (S_ISREG(st.st_mode)) { // worktree: .git names the real directory
+				FILE *link = fopen(path, "r");
+				char target[1024] = "";
+				if (link) {
+					if (fgets(target, sizeof(target), link) && strncmp(target, "gitdir: ", 8) == 0) {
+						target[strcspn(target, "\n")] = '\0';
+						if (target[8] == '/') snprintf(path, sizeof(path), "%s/HEAD", target + 8);
+						else snprintf(path + len, sizeof(path) - len, "/%s/HEAD", target + 8);
+					}
+					fclose(link);
+				}
+			} else {
+				snprintf(path + len, sizeof(path) - len, "/.git/HEAD");
+			}
+			f = fopen(path, "r");
+		}
+		if (f) {
+			if (fgets(head, sizeof(head), f)) {
+				head[strcspn(head, "\n")] = '\0';
+				if (strncmp(head, "ref: refs/heads/", 16) == 0) snprintf(branch, size, "%s", head + 16);
+				else snprintf(branch, size, "%.7s", head); // detached
+			}
+			fclose(f);
+			return;
+		}
+		path[len] = '\0';
+		char *slash = strrchr(path, '/');
+		if (slash == NULL || slash == path) return;
+		*slash = '\0';
+	}
+}
+
+// Worker thread computing the git segment whenever it is asked to
+void *prompt_worker(void *arg) {
+	(void)arg;
+	pthread_mutex_lock(&prompt_cache.lock);
+	while (1) {
+		while (prompt_cache.computed == prompt_cache.requested)
+			pthread_cond_wait(&prompt_cache.wake, &prompt_cache.lock);
+		uint64_t request = prompt_cache.requested;
+		char dir[1024], branch[256], text[300];
+		snprintf(dir, sizeof(dir), "%s", prompt_cache.git_dir);
+		pthread_mutex_unlock(&prompt_cache.lock);
+
+		git_branch(dir, branch, sizeof(branch));
+		int len = branch[0] ? snprintf(text, sizeof(text), " (%s)", branch) : 0;
+
+		pthread_mutex_lock(&prompt_cache.lock);
+		prompt_cache.computed = request;
+		if (request == prompt_cache.requested &&
+			((size_t)len != prompt_cache.len[SEGMENT_GIT] || memcmp(text, prompt_cache.text[SEGMENT_GIT], len) != 0)) {
+			memcpy(prompt_cache.text[SEGMENT_GIT], text, len);
+			prompt_cache.len[SEGMENT_GIT] = len;
+			uint64_t one = 1;
+			if (write(prompt_cache.ready_fd, &one, sizeof(one)) < 0) {} // the editor draws the prompt again
+		}
+	}
+	return NULL;
+}
+
+// Function to drop a cached segment so the next prompt formats it again
+void prompt_invalidate(enum prompt_segments segment) {
+	prompt_cache.valid[segment] = false;
+	if (segment == SEGMENT_CWD) prompt_cache.valid[SEGMENT_GIT] = false;
+}
+
+// Function to format one segment
+void prompt_segment(enum prompt_segments segment) {
+	char *text = prompt_cache.text[segment];
+	size_t size = sizeof(prompt_cache.text[segment]);
+	int len = 0;
+	if (segment == SEGMENT_USER) {
+		const char *user = getenv("USER");
+		struct passwd *pw = user ? NULL : getpwuid(getuid());
+		len = snprintf(text, size, "%s", user ? user : pw ? pw->pw_name : "?");
+	} else if (segment == SEGMENT_HOST) {
+		if (gethostname(text, size) == 0) len = strnlen(text, size - 1);
+		text[len] = '\0';
+	} else if (segment == SEGMENT_CWD) {
+		if (getcwd(text, size) == NULL) snprintf(text, size, "?");
+		len = strlen(text);
+	} else if (segment == SEGMENT_GIT) { // only asks the worker; the old branch stays until it answers
+		if (prompt_cache.ready_fd < 0) {
+			prompt_cache.ready_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+			pthread_t thread;
+			if (prompt_cache.ready_fd >= 0 && pthread_create(&thread, NULL, prompt_worker, NULL) == 0)
+				pthread_detach(thread);
+		}
+		pthread_mutex_lock(&prompt_cache.lock);
+		snprintf(prompt_cache.git_dir, sizeof(prompt_cache.git_dir), "%s", prompt_cache.text[SEGMENT_CWD]);
+		prompt_cache.requested++;
+		pthread_cond_signal(&prompt_cache.wake);
+		pthread_mutex_unlock(&prompt_cache.lock);
+		prompt_cache.valid[segment] = true;
+		return;
+	} else if (segment == SEGMENT_JOBS) {
+		prompt_cache.jobs = job_count;
+		if (job_count > 0) len = snprintf(text, size, " [%d job%s]", job_count, job_count > 1 ? "s" : "");
+	} else if (segment == SEGMENT_DURATION) {
+		prompt_cache.duration = prompt_cache.last_duration;
+		if (prompt_cache.duration >= 1) len = snprintf(text, size, " %.1fs", prompt_cache.duration);
+	} else if (segment == SEGMENT_STATUS) {
+		prompt_cache.status = last_status;
+		if (last_status != 0) len = snprintf(text, size, " [%d]", last_status);
+	}
+	prompt_cache.len[segment] = len < 0 ? 0 : (size_t)len >= size ? size - 1 : (size_t)len;
+	prompt_cache.valid[segment] = true;
+}
+
 /**
- * Show the command prompt
- * @return [description]
+ * Render the command prompt into out from the cached segments
+ * @return length of the prompt
  */
-int show_prompt() {
-	char cwd[1024], hostname[1024];
-	gethostname(hostname, sizeof(hostname));
-	getcwd(cwd, sizeof(cwd));
-	printf("%s@%s:%s %s$ ", getenv("USER"), hostname, cwd, sysname);
-	return 0;
+size_t render_prompt(char *out, size_t size) {
+	if (prompt_cache.jobs != job_count) prompt_invalidate(SEGMENT_JOBS);
+	if (prompt_cache.duration != prompt_cache.last_duration) prompt_invalidate(SEGMENT_DURATION);
+	if (prompt_cache.status != last_status) prompt_invalidate(SEGMENT_STATUS);
+	for (int segment = 0; segment < SEGMENT_COUNT; segment++)
+		if (!prompt_cache.valid[segment]) prompt_segment(segment);
+
+	// user@host:cwd (branch) [jobs] duration [status] Hshell$
+	static const char separators[SEGMENT_COUNT] = {0, '@', ':'};
+	size_t len = 0;
+	pthread_mutex_lock(&prompt_cache.lock);
+	for (int segment = 0; segment < SEGMENT_COUNT; segment++) {
+		if (separators[segment] && len + 1 < size) out[len++] = separators[segment];
+		size_t n = prompt_cache.len[segment] < size - 1 - len ? prompt_cache.len[segment] : size - 1 - len;
+		memcpy(out + len, prompt_cache.text[segment], n);
+		len += n;
+	}
+	pthread_mutex_unlock(&prompt_cache.lock);
+	int tail = snprintf(out + len, size - len, " %s$ ", sysname);
+	return tail < 0 ? len : len + (size_t)tail >= size ? size - 1 : len + tail;
+}
+
+// Function to close the argument vector of a command being parsed
+void finish_parsed_command(struct command_t *command, char **slots, int start, int *used) {
+	if (*used == start) slots[(*used)++] = ""; // no words: empty command
+	command->args = slots + start;
+	command->name = command->args[0];
+	slots[(*used)++] = NULL;
+	command->arg_count = *used - start; // name and NULL included, as exec wants
+}
+
+// Function to unquote the word at *cursor into *out, advancing both
+char *parse_word(const char **cursor, char **out) {
+	const char *p = *cursor;
+	char *word = *out, *o = *out;
+	while (*p && !strchr(" \t\n|&<>", *p)) {
+		if (*p == '\'') { // literal up to the closing quote
+			for (p++; *p && *p != '\''; ) *o++ = *p++;
+			if (*p) p++;
+		} else if (*p == '"') {
+			for (p++; *p && *p != '"'; ) {
+				if (*p == '\\' && p[1] && strchr("\"\\$`", p[1])) p++;
+				*o++ = *p++;
+			}
+			if (*p) p++;
+		} else if (*p == '\\' && p[1]) {
+			p++;
+			*o++ = *p++;
+		} else {
+			*o++ = *p++;
+		}
+	}
+	*o++ = '\0';
+	*cursor = p;
+	*out = o;
+	return word;
+}
+
+// Function to parse a redirection operator and its target at *cursor
+struct redirect_t *parse_redirect(const char **cursor, char **out) {
+	const char *p = *cursor;
+	struct redirect_t *redirect = arena_alloc(&line_arena, sizeof(struct redirect_t));
+	memset(redirect, 0, sizeof(struct redirect_t));
+	redirect->fd = *p == '<' ? STDIN_FILENO : STDOUT_FILENO;
+	if (isdigit((unsigned char)*p)) redirect->fd = strtol(p, (char **)&p, 10);
+	redirect->kind = *p == '<' ? REDIRECT_IN : REDIRECT_OUT;
+	p++;
+	if (redirect->kind == REDIRECT_OUT && *p == '>') {
+		redirect->kind = REDIRECT_APPEND;
+		p++;
+	}
+	if (*p == '&' && redirect->kind != REDIRECT_APPEND) { // duplicate a descriptor
+		p++;
+		if (!isdigit((unsigned char)*p)) return NULL;
+		redirect->kind = REDIRECT_DUP;
+		redirect->dup_fd = strtol(p, (char **)&p, 10);
+		*cursor = p;
+		return redirect;
+	}
+	while (*p == ' ' || *p == '\t') p++;
+	if (*p == '\0' || strchr("\n|&<>", *p)) return NULL; // missing file name
+	redirect->target = parse_word(&p, out);
+	*cursor = p;
+	return redirect;
 }
 
 /**
  * Parse a command string into a command struct
+ * A single pass over the line: words are unquoted straight into one string
+ * area and argument vectors are carved from one pointer area, both taken from
+ * line_arena and sized from the line length, so nothing is reallocated.
+ * Supports '...' (literal), "..." (with \" \\ \$ \` escapes), \ escapes and
+ * the redirections [n]<file, [n]>file, [n]>>file and [n]>&m.
  * @param  buf     [description]
  * @param  command [description]
- * @return         0
+ * @return         0, or -1 on a syntax error (command is left empty)
  */
 int parse_command(char *buf, struct command_t *command) {
-	const char *splitters = " \t"; // split at whitespace
-	int index, len;
-	len = strlen(buf);
+	size_t len = strlen(buf);
+	char *out = arena_alloc(&line_arena, 2 * len + 1); // a word never outgrows its source
+	char **slots = arena_alloc(&line_arena, sizeof(char *) * (2 * len + 4));
+	int used = 0, start = 0;
+	struct command_t *current = command;
+	struct redirect_t **redirect_tail = &command->redirects;
+	const char *p = buf;
+	memset(command, 0, sizeof(struct command_t));
 
-	// trim left whitespace
-	while (len > 0 && strchr(splitters, buf[0]) != NULL) {
-		buf++;
-		len--;
+	// auto-complete
+	const char *last = buf + len;
+	while (last > buf && (last[-1] == ' ' || last[-1] == '\t' || last[-1] == '\n')) last--;
+	if (last > buf && last[-1] == '?') {
+		command->auto_complete = true;
 	}
 
-	while (len > 0 && strchr(splitters, buf[len - 1]) != NULL) {
-		// trim right whitespace
-		buf[--len] = 0;
+	while (1) {
+		while (*p == ' ' || *p == '\t' || *p == '\n') p++;
+
+		// end of a command, possibly piping to another one
+		if (*p == '\0' || *p == '|') {
+			finish_parsed_command(current, slots, start, &used);
+			if (*p == '\0') break;
+			p++;
+			struct command_t *c = arena_alloc(&line_arena, sizeof(struct command_t));
+			memset(c, 0, sizeof(struct command_t));
+			current->next = c;
+			current = c;
+			redirect_tail = &c->redirects;
+			start = used;
+			continue;
+		}
+
+		// background process
+		if (*p == '&') {
+			command->background = true;
+			p++;
+			continue;
+		}
+
+		// redirection, optionally preceded by a descriptor number
+		const char *digits = p;
+		while (isdigit((unsigned char)*digits)) digits++;
+		if (*digits == '<' || *digits == '>') {
+			struct redirect_t *redirect = parse_redirect(&p, &out);
+			if (redirect == NULL) {
+				fprintf(stderr, "-%s: syntax error near '%.*s'\n", sysname, (int)strcspn(p, " \t"), p);
+				memset(command, 0, sizeof(struct command_t));
+				used = start = 0;
+				finish_parsed_command(command, slots, start, &used);
+				return -1;
+			}
+			*redirect_tail = redirect;
+			redirect_tail = &redirect->next;
+			continue;
+		}
+
+		// normal arguments
+		slots[used++] = parse_word(&p, &out);
 	}
+	return 0;
+}
 
-	// auto-complete
-	if (len > 0 && buf[len - 1] == '?') {
-		command->auto_complete = true;
+// Function to queue bytes for the terminal
+void editor_emit(const char *bytes, size_t len) {
+	if (editor.out_len + len > editor.out_cap) {
+		while (editor.out_len + len > editor.out_cap) editor.out_cap = editor.out_cap ? editor.out_cap * 2 : 4096;
+		editor.out = realloc(editor.out, editor.out_cap);
 	}
+	memcpy(editor.out + editor.out_len, bytes, len);
+	editor.out_len += len;
+}
 
-	// background
-	if (len > 0 && buf[len - 1] == '&') {
-		command->background = true;
+// Function to write everything queued for the terminal with one write
+void editor_flush(void) {
+	fflush(stdout); // anything printed with stdio goes first
+	size_t done = 0;
+	while (done < editor.out_len) {
+		ssize_t w = write(STDOUT_FILENO, editor.out + done, editor.out_len - done);
+		if (w < 0 && errno == EINTR) continue;
+		if (w < 0) break;
+		done += w;
 	}
+	editor.out_len = 0;
+}
+
+size_t editor_length(void) {
+	return editor.gap_start + editor.capacity - editor.gap_end;
+}
 
-	char *pch = strtok(buf, splitters);
-	if (pch == NULL) {
-		command->name = (char *)calloc(1, 1);
-		command->name[0] = 0;
+// Function to copy the line, or only the part before the cursor, into a new string
+char *editor_line(bool before_cursor) {
+	size_t after = before_cursor ? 0 : editor.capacity - editor.gap_end;
+	char *line = malloc(editor.gap_start + after + 1);
+	memcpy(line, editor.text, editor.gap_start);
+	memcpy(line + editor.gap_start, editor.text + editor.gap_end, after);
+	line[editor.gap_start + after] = '\0';
+	return line;
+}
+
+// Function to insert bytes at the cursor
+void editor_insert(const char *bytes, size_t len) {
+	if (editor.gap_end - editor.gap_start < len) { // grow the gap
+		size_t after = editor.capacity - editor.gap_end;
+		size_t capacity = editor.capacity ? editor.capacity : 256;
+		while (capacity - editor.gap_start - after < len) capacity *= 2;
+		editor.text = realloc(editor.text, capacity);
+		memmove(editor.text + capacity - after, editor.text + editor.gap_end, after);
+		editor.gap_end = capacity - after;
+		editor.capacity = capacity;
+	}
+	memcpy(editor.text + editor.gap_start, bytes, len);
+	editor.gap_start += len;
+	// typing at the end of a line that still fits is just an echo
+	if (!editor.dirty && editor.gap_end == editor.capacity &&
+		editor.prompt_len + editor.gap_start - editor.view < (size_t)editor.columns) {
+		editor_emit(bytes, len);
 	} else {
-		command->name = (char *)calloc(strlen(pch) + 1, 1);
-		strcpy(command->name, pch);
+		editor.dirty = true;
 	}
+}
 
-	command->args = (char **)calloc(sizeof(char *), 1);
+// Function to move the cursor by delta bytes, carrying them across the gap
+void editor_move(long delta) {
+	while (delta < 0 && editor.gap_start > 0) {
+		editor.text[--editor.gap_end] = editor.text[--editor.gap_start];
+		delta++;
+	}
+	while (delta > 0 && editor.gap_end < editor.capacity) {
+		editor.text[editor.gap_start++] = editor.text[editor.gap_end++];
+		delta--;
+	}
+	editor.dirty = true;
+}
 
-	int arg_index = 0;
-	char temp_buf[1024], *arg;
+// Function to delete bytes before (negative) or after (positive) the cursor
+void editor_delete(long count) {
+	if (count < 0) editor.gap_start -= (size_t)-count > editor.gap_start ? editor.gap_start : (size_t)-count;
+	else editor.gap_end += (size_t)count > editor.capacity - editor.gap_end ? editor.capacity - editor.gap_end : (size_t)count;
+	editor.dirty = true;
+}
 
-	while (1) {
-		// tokenize input on splitters
-		pch = strtok(NULL, splitters);
-		if (!pch)
-			break;
-		arg = temp_buf;
-		strcpy(arg, pch);
-		len = strlen(arg);
+// Function to replace the whole line
+void editor_set(const char *text, size_t len) {
+	editor.gap_start = 0;
+	editor.gap_end = editor.capacity;
+	editor.dirty = true;
+	editor_insert(text, len);
+}
 
-		// empty arg, go for next
-		if (len == 0) {
-			continue;
-		}
+// Function to draw the prompt and the visible window of the line, scrolling
+// sideways when it is wider than the terminal
+void editor_refresh(void) {
+	size_t width = editor.columns > (int)editor.prompt_len + 1 ? editor.columns - editor.prompt_len - 1 : 1;
+	size_t length = editor_length();
+	if (editor.gap_start < editor.view) editor.view = editor.gap_start;
+	if (editor.gap_start > editor.view + width) editor.view = editor.gap_start - width;
+	if (editor.view > 0 && length - editor.view < width) editor.view = length > width ? length - width : 0;
 
-		// trim left whitespace
-		while (len > 0 && strchr(splitters, arg[0]) != NULL) {
-			arg++;
-			len--;
+	editor_emit("\r", 1);
+	editor_emit(editor.prompt, editor.prompt_len);
+	size_t end = editor.view + width < length ? editor.view + width : length;
+	for (size_t from = editor.view; from < end;) { // the two sides of the gap
+		if (from < editor.gap_start) {
+			size_t to = end < editor.gap_start ? end : editor.gap_start;
+			editor_emit(editor.text + from, to - from);
+			from = to;
+		} else {
+			editor_emit(editor.text + editor.gap_end + (from - editor.gap_start), end - from);
+			from = end;
 		}
+	}
+	char move[32];
+	int len = snprintf(move, sizeof(move), "\033[K\r\033[%zuC", editor.prompt_len + editor.gap_start - editor.view);
+	editor_emit(move, len);
+	editor.dirty = false;
+}
 
-		// trim right whitespace
-		while (len > 0 && strchr(splitters, arg[len - 1]) != NULL) {
-			arg[--len] = 0;
+// Function to get the next input byte. When the buffer is empty the pending
+// output is drawn and written, then the terminal is read in bulk; finished
+// jobs are reaped while waiting. Returns -1 at end of input.
+int editor_read_key(void) {
+	if (editor.in_pos == editor.in_len) {
+		if (editor.dirty) editor_refresh();
+		editor_flush();
+		struct pollfd fds[3] = {{STDIN_FILENO, POLLIN, 0}, {sigchld_fd, POLLIN, 0}, {prompt_cache.ready_fd, POLLIN, 0}};
+		while (sigchld_fd >= 0) {
+			if (poll(fds, 3, -1) == -1 && errno != EINTR) break;
+			if (fds[2].revents & POLLIN) { // the git segment arrived
+				uint64_t count;
+				if (read(prompt_cache.ready_fd, &count, sizeof(count)) < 0) {}
+				editor.prompt_len = render_prompt(editor.prompt, sizeof(editor.prompt));
+				if (!editor.searching) {
+					editor_refresh();
+					editor_flush();
+				}
+			}
+			if (fds[1].revents & POLLIN) {
+				reap_jobs();
+				if (editor.columns == 0) { // the window was resized
+					struct winsize ws;
+					editor.columns = ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col ? ws.ws_col : 80;
+					editor_refresh();
+					editor_flush();
+				}
+			}
+			if (fds[0].revents) break;
 		}
+		ssize_t n;
+		while ((n = read(STDIN_FILENO, editor.in, sizeof(editor.in))) < 0 && errno == EINTR);
+		if (n <= 0) return -1;
+		editor.in_len = n;
+		editor.in_pos = 0;
+	}
+	return (unsigned char)editor.in[editor.in_pos++];
+}
 
-		// empty arg, go for next
-		if (len == 0) {
-			continue;
-		}
+// Function to get entry n of the history and its length
+const char *history_entry(uint64_t n, size_t *len) {
+	uint64_t offset = history.offsets[n % HISTORY_MAX];
+	const char *text = history.map + offset;
+	*len = (const char *)memchr(text, '\n', history.map_len - offset) - text;
+	return text;
+}
 
-		// piping to another command
-		if (strcmp(arg, "|") == 0) {
-			struct command_t *c = calloc(sizeof(struct command_t), 1);
-			int l = strlen(pch);
-			pch[l] = splitters[0]; // restore strtok termination
-			index = 1;
-			while (pch[index] == ' ' || pch[index] == '\t')
-				index++; // skip whitespaces
+// Function to compute the bigram mask used to skip entries during search
+uint64_t history_signature(const char *text, size_t len) {
+	uint64_t mask = 0;
+	for (size_t i = 1; i < len; i++)
+		mask |= 1ULL << ((((unsigned char)text[i - 1] * 31u) ^ (unsigned char)text[i]) & 63);
+	return mask;
+}
 
-			parse_command(pch + index, c);
-			pch[l] = 0; // put back strtok termination
-			command->next = c;
-			continue;
-		}
+// Function to map the history file again and index lines appended since the
+// last look, including those written by other shells
+void history_sync(void) {
+	if (!history.enabled) return;
+	int fd = open(history.path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return;
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return;
+	}
+	bool replaced = st.st_dev != history.dev || st.st_ino != history.ino || (size_t)st.st_size < history.indexed;
+	if (replaced) {
+		history.indexed = 0; // the file was replaced by a compaction, start over
+		history.total = 0;
+		history.dev = st.st_dev;
+		history.ino = st.st_ino;
+	}
+	// the old mapping belongs to the old file even when the sizes happen to match
+	if (replaced || (size_t)st.st_size != history.map_len) {
+		if (history.map) munmap(history.map, history.map_len);
+		history.map = st.st_size ? mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0) : NULL;
+		history.map_len = history.map == MAP_FAILED || history.map == NULL ? 0 : st.st_size;
+		if (history.map == MAP_FAILED) history.map = NULL;
+	}
+	close(fd);
 
-		// background process
-		if (strcmp(arg, "&") == 0) {
-			// handled before
-			continue;
+	// only complete lines become entries; a concurrent append may be half visible
+	const char *end = history.map + history.map_len;
+	const char *line = history.map + history.indexed;
+	const char *newline;
+	while (line < end && (newline = memchr(line, '\n', end - line)) != NULL) {
+		if (history.total >= history.capacity && history.capacity < HISTORY_MAX) {
+			history.capacity = history.capacity ? history.capacity * 2 : 1024;
+			history.offsets = realloc(history.offsets, sizeof(uint64_t) * history.capacity);
+			history.signatures = realloc(history.signatures, sizeof(uint64_t) * history.capacity);
 		}
+		history.offsets[history.total % HISTORY_MAX] = line - history.map;
+		history.signatures[history.total % HISTORY_MAX] = 0;
+		history.total++;
+		line = newline + 1;
+	}
+	history.indexed = line - history.map;
+}
 
-		// normal arguments
-		
-		if (len > 2 &&
-			((arg[0] == '"' && arg[len - 1] == '"') ||
-			 (arg[0] == '\'' && arg[len - 1] == '\''))) // quote wrapped arg
-		{
-			arg[--len] = 0;
-			arg++;
-		}
+// Function to open the persistent history in $HOME/.hshell_history
+void history_open(void) {
+	if (getenv("HOME") == NULL) return;
+	snprintf(history.path, sizeof(history.path), "%s/.hshell_history", getenv("HOME"));
+	history.enabled = 1;
+	history_sync();
+}
 
-		command->args =
-			(char **)realloc(command->args, sizeof(char *) * (arg_index + 1));
+// Function to rewrite the history file with only its newest HISTORY_MAX entries
+void history_compact(void) {
+	char tmp_path[4200];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.%d", history.path, (int)getpid());
+	FILE *file = fopen(tmp_path, "w");
+	if (!file) return;
+	for (uint64_t n = history.total - HISTORY_MAX; n < history.total; n++) {
+		size_t len;
+		const char *text = history_entry(n, &len);
+		fwrite(text, 1, len + 1, file);
+	}
+	if (fclose(file) != 0 || rename(tmp_path, history.path) != 0) remove(tmp_path);
+	history_sync();
+}
 
-		command->args[arg_index] = (char *)calloc(len + 1, 1);
-		strcpy(command->args[arg_index++], arg);
+// Function to append a line to the history; a single O_APPEND write keeps
+// lines from concurrent shells whole without any locking
+void history_add(const char *line) {
+	size_t len = strlen(line);
+	if (!history.enabled || len == 0 || strchr(line, '\n')) return;
+	history_sync();
+	if (history.total > 0) { // skip repeats of the previous command
+		size_t last_len;
+		const char *last = history_entry(history.total - 1, &last_len);
+		if (last_len == len && memcmp(last, line, len) == 0) return;
 	}
-	command->arg_count = arg_index;
+	char *record = malloc(len + 1);
+	memcpy(record, line, len);
+	record[len] = '\n';
+	int fd = open(history.path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+	if (fd >= 0) {
+		if (write(fd, record, len + 1) != (ssize_t)(len + 1)) perror("history");
+		close(fd);
+	}
+	free(record);
+	history_sync();
+	if (history.total >= 2 * (uint64_t)HISTORY_MAX) history_compact();
+}
 
-	// increase args size by 2
-	command->args = (char **)realloc(
-		command->args, sizeof(char *) * (command->arg_count += 2));
+// Function to find the newest entry at or before n containing query; entries
+// whose bigram mask lacks a bigram of the query are skipped without a scan.
+// Returns history.total when nothing matches.
+uint64_t history_find(const char *query, size_t qlen, uint64_t n, const char *skip, size_t skip_len) {
+	uint64_t first = history.total > HISTORY_MAX ? history.total - HISTORY_MAX : 0;
+	uint64_t wanted = history_signature(query, qlen);
+	for (n = n + 1; n-- > first;) {
+		size_t len;
+		const char *text = history_entry(n, &len);
+		uint64_t *signature = &history.signatures[n % HISTORY_MAX];
+		if (*signature == 0) *signature = history_signature(text, len);
+		if ((*signature & wanted) != wanted) continue;
+		if (skip && len == skip_len && memcmp(text, skip, len) == 0) continue; // same text as the current match
+		if (memmem(text, len, query, qlen)) return n;
+	}
+	return history.total;
+}
 
-	// shift everything forward by 1
-	for (int i = command->arg_count - 2; i > 0; --i) {
-		command->args[i] = command->args[i - 1];
+// Function to move through the history with the arrow keys
+void history_step(int direction) {
+	uint64_t first = history.total > HISTORY_MAX ? history.total - HISTORY_MAX : 0;
+	if (history.cursor > history.total) history.cursor = history.total;
+	if (direction < 0 && history.cursor > first) {
+		if (history.cursor == history.total) { // remember the line being typed
+			free(history.saved);
+			history.saved = editor_line(false);
+			history.saved_len = editor_length();
+		}
+		history.cursor--;
+	} else if (direction > 0 && history.cursor < history.total) {
+		history.cursor++;
+	} else {
+		return;
 	}
+	size_t len = history.saved_len;
+	const char *text = history.cursor == history.total ? history.saved : history_entry(history.cursor, &len);
+	editor_set(text ? text : "", text ? len : 0);
+}
 
-	// set args[0] as a copy of name
-	command->args[0] = strdup(command->name);
+// Function to run an incremental reverse search (Ctrl+R). Typing narrows the
+// search from the current match, Ctrl+R again goes to an older match, Ctrl+G
+// cancels and any other key keeps the match. Returns the key that ended it.
+int history_search(void) {
+	char query[256] = "";
+	size_t qlen = 0, len = 0;
+	uint64_t found = history.total;
+	const char *text = "";
+	bool failing = false;
 
-	// set args[arg_count-1] (last) to NULL
-	command->args[command->arg_count - 1] = NULL;
+	editor.searching = true;
+	while (1) {
+		char status[512];
+		int status_len = snprintf(status, sizeof(status), "\r\033[K(%sreverse-i-search)`%s': ",
+								  failing ? "failed " : "", query);
+		editor_emit(status, status_len);
+		editor_emit(text, len);
+		int c = editor_read_key();
+		uint64_t n = history.total;
+		if (c == 18 && found < history.total && found > 0) { // Ctrl+R: older match
+			n = history_find(query, qlen, found - 1, text, len);
+		} else if (c == 127 || c == 8) {
+			if (qlen > 0) query[--qlen] = '\0';
+			if (history.total > 0) n = history_find(query, qlen, history.total - 1, NULL, 0);
+		} else if (c == 7) { // Ctrl+G
+			editor.dirty = true;
+			editor.searching = false;
+			return c;
+		} else if (c >= 32 && c < 127 && qlen < sizeof(query) - 1) {
+			query[qlen++] = c;
+			query[qlen] = '\0';
+			uint64_t from = found < history.total ? found : history.total - 1;
+			if (history.total > 0) n = history_find(query, qlen, from, NULL, 0);
+		} else if (c != 18) { // leave the search keeping the match
+			if (found < history.total) editor_set(text, len);
+			editor.dirty = true;
+			editor.searching = false;
+			return c;
+		}
+		failing = n == history.total;
+		if (!failing) {
+			found = n;
+			text = history_entry(found, &len);
+		}
+	}
+}
 
-	return 0;
+// Function to complete the word before the cursor, listing the candidates
+// when there is more than one
+void editor_complete(void) {
+	char *buf = editor_line(true);
+	char *fname = calloc(strlen(buf) + 1, 1);
+	struct autocomplete_struct *match;
+	int command_or_filename = check_command_or_filename(buf, fname); //update buffer and check
+	free(buf);
+	buf = editor_line(false);
+	if (command_or_filename) { // complete filename case
+		match = directory_complete(fname); //find all matching files in the directory
+	} else { // complete command case
+		match = command_complete(fname); //find all matching commands
+	}
+
+	if (match->count == 1) {
+		int match_len = strlen(match->matches[0]);
+		editor_insert(match->matches[0] + match->stem_len, match_len - match->stem_len);
+		// keep completing inside a directory
+		if (!command_or_filename || match->matches[0][match_len - 1] != '/') editor_insert(" ", 1);
+	} else if (match->count > 1) {
+		editor_flush();
+		if (command_or_filename) {
+			printf("\n");
+			for (int i = 0; i < match->count; i++) {
+				if(strstr(buf,"cd")==NULL) printf("%s ", match->matches[i]);
+				else if (match->matches[i][strlen(match->matches[i])-1]=='/') printf("%s ", match->matches[i]);
+			}
+			printf("\n");
+		} else {
+			printf("\nAvailable commands: \n");
+			for (int i = 0; i < match->count; i++) printf(" - %s \n", match->matches[i]);
+			printf("\n");
+		}
+		editor.dirty = true;
+	}
+	free_autocomplete_struct(match); //free match struct
+	free(match);
+	free(fname); //free fname
+	free(buf);
 }
 
-void prompt_backspace() {
-	putchar(8); // go back 1
-	putchar(' '); // write empty over
-	putchar(8); // go back 1 again
+// Function to decode an escape sequence (arrow and editing keys)
+void editor_escape(void) {
+	int c = editor_read_key();
+	if (c != '[' && c != 'O') return;
+	int code = editor_read_key(), number = 0;
+	while (code >= '0' && code <= '9') { // ESC [ n ~
+		number = number * 10 + code - '0';
+		code = editor_read_key();
+	}
+	if (code == 'A') history_step(-1);
+	else if (code == 'B') history_step(1);
+	else if (code == 'C') editor_move(1);
+	else if (code == 'D') editor_move(-1);
+	else if (code == 'H' || (code == '~' && (number == 1 || number == 7))) editor_move(-(long)editor.gap_start);
+	else if (code == 'F' || (code == '~' && (number == 4 || number == 8))) editor_move(editor.capacity - editor.gap_end);
+	else if (code == '~' && number == 3) editor_delete(1);
 }
 
+// Function to set up the terminal modes once; the raw mode is derived from
+// the cooked one so only tcsetattr is needed around each prompt
+void editor_init(void) {
+	editor.have_termios = tcgetattr(STDIN_FILENO, &editor.cooked) == 0;
+	editor.raw = editor.cooked;
+	// ICANON normally takes care that one line at a time will be processed
+	// that means it will return if it sees a "\n" or an EOF or an EOL
+	// ECHO: we echo ourselves; ISIG: Ctrl+C reaches the editor as a key
+	editor.raw.c_lflag &= ~(ICANON | ECHO | ISIG);
+	editor.raw.c_cc[VMIN] = 1;
+	editor.raw.c_cc[VTIME] = 0;
+}
 
 /**
  * Prompt a command from the user
- * @param  buf      [description]
- * @param  buf_size [description]
- * @return          [description]
+ * @param  command filled with the parsed line
+ * @return         SUCCESS, or EXIT on Ctrl+D or end of input
  */
 int prompt(struct command_t *command) {
-	size_t index = 0;
-	char c;
-	char buf[4096];
-	static char oldbuf[4096];
-	char *fname;
-
-	// tcgetattr gets the parameters of the current terminal
-	// STDIN_FILENO will tell tcgetattr that it should write the settings
-	// of stdin to oldt
-	static struct termios backup_termios, new_termios;
-	tcgetattr(STDIN_FILENO, &backup_termios);
-	new_termios = backup_termios;
-	// ICANON normally takes care that one line at a time will be processed
-	// that means it will return if it sees a "\n" or an EOF or an EOL
-	new_termios.c_lflag &=
-		~(ICANON |
-		  ECHO); // Also disable automatic echo. We manually echo each char.
-	// Those new settings will be set to STDIN
-	// TCSANOW tells tcsetattr to change attributes immediately.
-	tcsetattr(STDIN_FILENO, TCSANOW, &new_termios);
-
-	show_prompt();
-	
-	for (int i=index; i<4096; i++) {
-		buf[i] = '\0';
+	if (editor.columns == 0) {
+		struct winsize ws;
+		editor.columns = ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col ? ws.ws_col : 80;
 	}
+	if (editor.have_termios) tcsetattr(STDIN_FILENO, TCSANOW, &editor.raw);
 
+	notify_jobs(true);
+	history_sync();
+	history.cursor = history.total;
+	editor.gap_start = 0;
+	editor.gap_end = editor.capacity;
+	editor.view = 0;
+	editor.prompt_len = render_prompt(editor.prompt, sizeof(editor.prompt));
+	editor_refresh();
+
+	int code = SUCCESS;
 	while (1) {
-		c = getchar();
+		int c = editor_read_key();
 		// printf("Keycode: %u\n", c); // DEBUG: uncomment for debugging
-		// handle tab
-		if (c == 9) {
-			if (index == 0) continue;
-			char *buf_cpy = strdup(buf);
-			fname = (char *)malloc(4096 * sizeof(char));
-			struct autocomplete_struct *match;
-			int command_or_filename = check_command_or_filename(buf_cpy, fname); //update buffer and check
-			if (command_or_filename) { // complete filename case
-				match = directory_complete(fname); //find all matching files in the directory
-				if (match->count == 1) {
-					for (int i = strlen(fname); i < (int) strlen(match->matches[0]); i++) {
-						putchar(match->matches[0][i]);
-						buf[index++] = match->matches[0][i];
-					}
-					c = ' ';
-				}else if (match->count > 1) {
-					printf("\n");
-					for (int i = 0; i < match->count; i++) {
-						if(strstr(buf,"cd")==NULL) printf("%s ", match->matches[i]);
-						else if (match->matches[i][strlen(match->matches[i])-1]=='/') printf("%s ", match->matches[i]);
-					}
-					printf("\n");
-					show_prompt();
-					printf("%s", buf);
-				}
-			}else { // complete command case                           
-				char *command = *buf_cpy ? strdup(buf_cpy) : NULL;
-				command = fname;
-				match = command_complete(command); //find all matching commands
-				if (match->count == 1) {
-					for (int i = strlen(command); i < (int) strlen(match->matches[0]); i++) {
-						putchar(match->matches[0][i]);
-						buf[index++] = match->matches[0][i];
-					}
-		            		c = ' ';
-		        	}else if (match->count > 1) {
-					printf("\nAvailable commands: \n");
-					for (int i = 0; i < match->count; i++) printf(" - %s \n", match->matches[i]);
-					printf("\n");
-					show_prompt();
-					printf("%s", buf);
-		        	}
-			}
-			free_autocomplete_struct(match); //free match struct
-			free(fname); //free fname
-			if (c == 9) {
-				continue;
-			}
+		if (c == 18) c = history_search(); // Ctrl+R, then handle the key that ended it
+		if (c == -1 || (c == 4 && editor_length() == 0)) { // Ctrl+D on an empty line
+			code = EXIT;
+			break;
+		}
+		if (c == '\n' || c == '\r') break; // enter key
+		if (c == 9) editor_complete(); // handle tab
+		else if (c == 127 || c == 8) editor_delete(-1); // handle backspace
+		else if (c == 4) editor_delete(1);
+		else if (c == 27) editor_escape();
+		else if (c == 1) editor_move(-(long)editor.gap_start); // Ctrl+A
+		else if (c == 5) editor_move(editor.capacity - editor.gap_end); // Ctrl+E
+		else if (c == 2) editor_move(-1); // Ctrl+B
+		else if (c == 6) editor_move(1); // Ctrl+F
+		else if (c == 11) editor_delete(editor.capacity - editor.gap_end); // Ctrl+K
+		else if (c == 21) editor_delete(-(long)editor.gap_start); // Ctrl+U
+		else if (c == 23) { // Ctrl+W: the word before the cursor
+			size_t at = editor.gap_start;
+			while (at > 0 && editor.text[at - 1] == ' ') at--;
+			while (at > 0 && editor.text[at - 1] != ' ') at--;
+			editor_delete(-(long)(editor.gap_start - at));
+		} else if (c == 12) { // Ctrl+L
+			editor_emit("\033[H\033[2J", 7);
+			editor.dirty = true;
+		} else if (c == 3) { // Ctrl+C drops the line
+			editor_move(editor.capacity - editor.gap_end);
+			editor_refresh();
+			editor_emit("^C\n", 3);
+			editor.gap_start = 0;
+			editor.gap_end = editor.capacity;
+			editor.view = 0;
+			editor.dirty = true;
+		} else if (c >= 32 || c == '\t') {
+			char ch = c;
+			editor_insert(&ch, 1);
 		}
+	}
 
-		// handle backspace
-		if (c == 127) {
-			if (index > 0) {
-				prompt_backspace();
-				index--;
-				for (int i=index; i<4096; i++) {
-					buf[i] = '\0';
-				}
+	// leave the cursor after the whole line
+	if (editor.gap_end != editor.capacity) editor_move(editor.capacity - editor.gap_end);
+	if (editor.dirty) editor_refresh();
+	editor_emit("\n", 1);
+	editor_flush();
+	if (editor.have_termios) tcsetattr(STDIN_FILENO, TCSANOW, &editor.cooked); // restore the old settings
+	if (code == EXIT) return EXIT;
+
+	char *line = editor_line(false);
+	history_add(line);
+	char *buf = arena_alloc(&line_arena, strlen(line) + 1);
+	strcpy(buf, line);
+	free(line);
+	parse_command(buf, command);
+
+	// print_command(command); // DEBUG: uncomment for debugging
+	return SUCCESS;
+}
+
+int process_command(struct command_t *command);
+
+// Buffered reader for batch mode: the script is read in large blocks and
+// lines are cut out of the block in place
+struct batch_reader {
+	int fd; // -1 once everything is in buf
+	char *buf;
+	size_t start, end, capacity;
+	unsigned long line_number;
+};
+
+// Function to get the next line of a script, NULL at the end
+char *batch_next_line(struct batch_reader *reader) {
+	while (1) {
+		char *newline = memchr(reader->buf + reader->start, '\n', reader->end - reader->start);
+		if (newline == NULL && reader->fd >= 0) { // need more of the script
+			if (reader->start > 0) { // keep the partial line at the front
+				memmove(reader->buf, reader->buf + reader->start, reader->end - reader->start);
+				reader->end -= reader->start;
+				reader->start = 0;
 			}
+			if (reader->capacity - reader->end < 65536) {
+				reader->capacity = reader->capacity * 2 + 65536;
+				reader->buf = realloc(reader->buf, reader->capacity + 1);
+			}
+			ssize_t n = read(reader->fd, reader->buf + reader->end, reader->capacity - reader->end);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) reader->fd = -1;
+			else reader->end += n;
 			continue;
 		}
-
-		if (c == 27 || c == 91 || c == 66 || c == 67 || c == 68) {
-			continue;
+		if (reader->start == reader->end) return NULL;
+		char *line = reader->buf + reader->start;
+		if (newline == NULL) { // last line without a newline
+			reader->buf[reader->end] = '\0';
+			reader->start = reader->end;
+		} else {
+			*newline = '\0';
+			reader->start = newline - reader->buf + 1;
 		}
+		reader->line_number++;
+		return line;
+	}
+}
 
-		// up arrow
-		if (c == 65) {
-			while (index > 0) {
-				prompt_backspace();
-				index--;
-			}
+/**
+ * Run commands read from a script without the prompt, the terminal,
+ * completion or history
+ * @return exit status of the last command
+ */
+int run_batch(struct batch_reader *reader) {
+	char *line;
+	while ((line = batch_next_line(reader)) != NULL) {
+		const char *p = line;
+		while (*p == ' ' || *p == '\t') p++;
+		if (*p == '#' || *p == '\0') continue; // comments, including a #! line
 
-			char tmpbuf[4096];
-			printf("%s", oldbuf);
-			strcpy(tmpbuf, buf);
-			strcpy(buf, oldbuf);
-			strcpy(oldbuf, tmpbuf);
-			index += strlen(buf);
+		struct command_t *command = arena_alloc(&line_arena, sizeof(struct command_t));
+		memset(command, 0, sizeof(struct command_t));
+		if (parse_command(line, command) == -1) {
+			fprintf(stderr, "-%s: line %lu: syntax error\n", sysname, reader->line_number);
+			last_status = 2;
+			free_command(command);
 			continue;
 		}
-
-		putchar(c); // echo the character
-		buf[index++] = c;
-		if (index >= sizeof(buf) - 1)
-			break;
-		if (c == '\n') // enter key
-			break;
-		if (c == 4) // Ctrl+D
-			return EXIT;
-	}
-
-	// trim newline from the end
-	if (index > 0 && buf[index - 1] == '\n') {
-		index--;
+		int code = process_command(command);
+		free_command(command);
+		if (code == EXIT) break;
+		if (job_count > 0) notify_jobs(false); // forget finished background jobs
 	}
-
-
-	// null terminate string
-	buf[index++] = '\0';
-
-	strcpy(oldbuf, buf);
-
-	parse_command(buf, command);
-
-	// print_command(command); // DEBUG: uncomment for debugging
-
-	// restore the old settings
-	tcsetattr(STDIN_FILENO, TCSANOW, &backup_termios);
-	return SUCCESS;
+	fflush(stdout);
+	return last_status;
 }
 
-int process_command(struct command_t *command);
+int main(int argc, char *argv[]) {
+	struct batch_reader reader = {.fd = -1};
+	bool batch = false;
+	if (argc > 2 && strcmp(argv[1], "-c") == 0) { // Hshell -c 'commands'
+		reader.end = reader.capacity = strlen(argv[2]);
+		reader.buf = malloc(reader.capacity + 1);
+		memcpy(reader.buf, argv[2], reader.end);
+		batch = true;
+	} else if (argc > 1 && argv[1][0] == '-' && strcmp(argv[1], "-") != 0) {
+		fprintf(stderr, "usage: %s [-c commands | script]\n", sysname);
+		return 2;
+	} else if (argc > 1) { // Hshell script, or - for stdin
+		reader.fd = strcmp(argv[1], "-") == 0 ? STDIN_FILENO : open(argv[1], O_RDONLY | O_CLOEXEC);
+		if (reader.fd == -1) {
+			fprintf(stderr, "-%s: %s: %s\n", sysname, argv[1], strerror(errno));
+			return 127;
+		}
+		batch = true;
+	} else if (!isatty(STDIN_FILENO)) { // commands piped in
+		reader.fd = STDIN_FILENO;
+		batch = true;
+	}
 
-int main() {
-	save_available_commands("all_commands.txt");
+	shell_interactive = !batch && isatty(STDIN_FILENO);
+	shell_pgid = getpgrp();
+	signal(SIGTTOU, SIG_IGN); // so the shell can take the terminal back from a job
+	if (!batch) {
+		history_open();
+		editor_init();
+	}
+	if (shell_interactive) {
+		// keyboard signals belong to the foreground job, not the shell
+		signal(SIGINT, SIG_IGN);
+		signal(SIGQUIT, SIG_IGN);
+		signal(SIGTSTP, SIG_IGN);
+		signal(SIGTTIN, SIG_IGN);
+	}
+	sigset_t sigchld_mask;
+	sigemptyset(&sigchld_mask);
+	sigaddset(&sigchld_mask, SIGCHLD);
+	if (!batch) sigaddset(&sigchld_mask, SIGWINCH);
+	sigprocmask(SIG_BLOCK, &sigchld_mask, NULL);
+	sigchld_fd = signalfd(-1, &sigchld_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (getenv("HSHELL_LAUNCHER") && strcmp(getenv("HSHELL_LAUNCHER"), "fork") == 0) launch_mode = LAUNCH_FORK;
+	if (batch) return run_batch(&reader);
+	save_available_commands();
 	
 	while (1) {
-		struct command_t *command = calloc(sizeof(struct command_t), 1);
+		command_index_poll();
+		struct command_t *command = arena_alloc(&line_arena, sizeof(struct command_t));
 
 		// set all bytes to 0
 		memset(command, 0, sizeof(struct command_t));
@@ -427,16 +1356,20 @@ int main() {
 			break;
 		}
 
+		struct timespec started, finished;
+		clock_gettime(CLOCK_MONOTONIC, &started);
 		code = process_command(command);
 		if (code == EXIT) {
 			break;
 		}
+		clock_gettime(CLOCK_MONOTONIC, &finished);
+		prompt_cache.last_duration = finished.tv_sec - started.tv_sec + (finished.tv_nsec - started.tv_nsec) / 1e9;
+		if (command->name[0]) prompt_invalidate(SEGMENT_GIT); // the command may have switched branches
 
 		free_command(command);
 	}
 
 	printf("\n");
-	remove("all_commands.txt");
 	return 0;
 }
 
@@ -467,12 +1400,87 @@ int process_command(struct command_t *command) {
 		return EXIT;
 	}
 
-	if (strcmp(command->name, "cd") == 0) {
+	if (strcmp(command->name, "time") == 0 && command->arg_count <= 2) {
+		printf("-%s: time: usage: time command [args]\n", sysname);
+		return SUCCESS;
+	}
+
+	if (strcmp(command->name, "time") == 0) { // time prefix
+		struct rusage before, after;
+		getrusage(RUSAGE_SELF, &before);
+		unsigned long started_jobs = jobs_started;
+		double started = now_seconds();
+		command->args++;
+		command->arg_count--;
+		command->name = command->args[0];
+		command->timed = true;
+		int code = process_command(command);
+		if (jobs_started == started_jobs) { // a builtin ran in the shell itself
+			getrusage(RUSAGE_SELF, &after);
+			after.ru_utime.tv_sec -= before.ru_utime.tv_sec;
+			after.ru_utime.tv_usec -= before.ru_utime.tv_usec;
+			after.ru_stime.tv_sec -= before.ru_stime.tv_sec;
+			after.ru_stime.tv_usec -= before.ru_stime.tv_usec;
+			after.ru_nvcsw -= before.ru_nvcsw;
+			after.ru_nivcsw -= before.ru_nivcsw;
+			print_usage(command->name, now_seconds() - started, &after);
+		}
+		return code;
+	}
+
+	if (command->redirects && command->next == NULL && is_parent_builtin(command->name)) {
+		return run_builtin_redirected(command);
+	}
+
+	if (strcmp(command->name, "hstats") == 0) {
+		return hstats_builtin(command);
+	}
+
+	if (strcmp(command->name, ":") == 0) {
+		last_status = 0;
+		return SUCCESS;
+	}
+
+	if (strcmp(command->name, "hash") == 0) {
+		return hash_builtin(command);
+	}
+
+	if (strcmp(command->name, "compgen") == 0) {
+		return compgen_builtin(command);
+	}
+
+	if (strcmp(command->name, "launcher") == 0) {
+		return launcher_builtin(command);
+	}
+
+	if (strcmp(command->name, "jobs") == 0) {
+		return jobs_builtin(command);
+	}
+
+	if (strcmp(command->name, "wait") == 0) {
+		return wait_builtin(command);
+	}
+
+	if (strcmp(command->name, "fg") == 0) {
+		return fg_builtin(command);
+	}
+
+	if (strcmp(command->name, "bg") == 0) {
+		return bg_builtin(command);
+	}
+
+	if (strcmp(command->name, "kill") == 0) {
+		return kill_builtin(command);
+	}
+
+	if (strcmp(command->name, "cd") == 0) {
 		if (command->arg_count > 0) {
 			r = chdir(command->args[1]);
 			if (r == -1) {
 				printf("-%s: %s: %s\n", sysname, command->name,
 					   strerror(errno));
+			} else {
+				prompt_invalidate(SEGMENT_CWD);
 			}
 
 			return SUCCESS;
@@ -491,6 +1499,7 @@ int process_command(struct command_t *command) {
 		strcpy(filename, command->args[2]);
 		pid_t pid_s1 = fork();
 		if (pid_s1 == 0){
+			reset_child_signals();
 			char temp1[50], temp2[50];
 			strcpy(temp1, "PID=");
 			sprintf(temp2, "%d", (int)root_process);
@@ -503,6 +1512,7 @@ int process_command(struct command_t *command) {
 			waitpid(pid_s1, NULL, 0);
 			pid_t pid_s2 = fork();
 			if (pid_s2 == 0) {
+				reset_child_signals();
 				command->arg_count = 2;
 				command->args = (char **)calloc(command->arg_count * sizeof(char *), 1);
 				command->name = "sudo";
@@ -513,7 +1523,7 @@ int process_command(struct command_t *command) {
 				waitpid(pid_s2, NULL, 0); // wait for child process
 				char buf[4096];
 				remove(filename);
-				sprintf(buf, "sudo dmesg -c -H | tee %s.txt", trim_space(filename));
+				sprintf(buf, "sudo dmesg -c -H > %s.txt", trim_space(filename));
 				parse_command(buf, command);
 				pipe_function(command);
 				char cmd2[100];
@@ -528,654 +1538,3794 @@ int process_command(struct command_t *command) {
 		}
 	}
 	    
-	if(command -> next != NULL){
-		return pipe_function(command); //indirect recursion inside process_command
-	}	
-	
-	pid_t pid = fork();
-	// child
-	if (pid == 0) {
-		/// This shows how to do exec with environ (but is not available on MacOs)
-		// extern char** environ; // environment variables
-		// execvpe(command->name, command->args, environ); // exec+args+path+environ
-
-		/// This shows how to do exec with auto-path resolve
-		// add a NULL argument to the end of args, and the name to the beginning
-		// as required by exec
-
-		// TODO: do your own exec with path resolving using execv() - done
-
-		if(strcmp(command->name,"regression")==0){
-			regressionAndPlot(command);
-		}else if(strcmp(command->name, "hdiff")==0){
-			hdiff(command);
-		}else if(strcmp(command->name, "textify")==0){
-			textify(command);
-		}else{
-			search_and_run_command(command,0);
+	return pipe_function(command);
+}
+
+// Function to tell whether a command is a builtin the shell runs in itself
+bool is_parent_builtin(const char *name) {
+	static const char *names[] = {"cd", ":", "hash", "compgen", "hstats", "launcher", "jobs", "wait", "fg", "bg", "kill"};
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+		if (strcmp(names[i], name) == 0) return true;
+	return false;
+}
+
+// Function to apply a command's redirections to the current process
+int apply_redirects(struct command_t *command) {
+	for (struct redirect_t *redirect = command->redirects; redirect; redirect = redirect->next) {
+		if (redirect->kind == REDIRECT_DUP) {
+			if (dup2(redirect->dup_fd, redirect->fd) == -1) {
+				fprintf(stderr, "-%s: %d: %s\n", sysname, redirect->dup_fd, strerror(errno));
+				return -1;
+			}
+			continue;
+		}
+		int flags = redirect->kind == REDIRECT_IN ? O_RDONLY :
+			redirect->kind == REDIRECT_OUT ? O_WRONLY | O_CREAT | O_TRUNC : O_WRONLY | O_CREAT | O_APPEND;
+		int fd = open(redirect->target, flags, 0666);
+		if (fd == -1) {
+			fprintf(stderr, "-%s: %s: %s\n", sysname, redirect->target, strerror(errno));
+			return -1;
+		}
+		if (fd != redirect->fd) {
+			dup2(fd, redirect->fd);
+			close(fd);
 		}
-		exit(0);
+	}
+	return 0;
+}
 
-	} else {
-		// TODO: implement background processes here done
-		//wait(0); // wait for child process to finish
-		int status;
-		if (command->background == false) {
-        		waitpid(pid, &status, 0);
-		} 
-		return SUCCESS;
+// Function to run a shell builtin with its redirections, restoring the
+// shell's own descriptors afterwards
+int run_builtin_redirected(struct command_t *command) {
+	int saved_fd[16], saved_copy[16], saved = 0, code = SUCCESS;
+	fflush(stdout);
+	fflush(stderr);
+	for (struct redirect_t *redirect = command->redirects; redirect && saved < 16; redirect = redirect->next) {
+		bool seen = false;
+		for (int i = 0; i < saved; i++) seen = seen || saved_fd[i] == redirect->fd;
+		if (seen) continue;
+		saved_fd[saved] = redirect->fd;
+		saved_copy[saved++] = fcntl(redirect->fd, F_DUPFD_CLOEXEC, 10); // -1 if it was closed
+	}
+
+	if (apply_redirects(command) == 0) {
+		struct redirect_t *redirects = command->redirects;
+		command->redirects = NULL;
+		code = process_command(command);
+		command->redirects = redirects;
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+	for (int i = saved - 1; i >= 0; i--) {
+		if (saved_copy[i] == -1) {
+			close(saved_fd[i]);
+			continue;
+		}
+		dup2(saved_copy[i], saved_fd[i]);
+		close(saved_copy[i]);
+	}
+	return code;
+}
+
+// Function to tell whether a stage is a builtin that has to run in a forked shell
+bool is_child_builtin(const char *name) {
+	return strcmp(name, "regression") == 0 || strcmp(name, "hdiff") == 0 ||
+		   strcmp(name, "textify") == 0 || strcmp(name, "hash") == 0 ||
+		   strcmp(name, "meter") == 0 || strcmp(name, ":") == 0 || strcmp(name, "compgen") == 0 ||
+		   strcmp(name, "hstats") == 0;
+}
+
+// Builtin "launcher": show or select how external commands are started
+int launcher_builtin(struct command_t *command) {
+	if (command->arg_count > 2) {
+		if (strcmp(command->args[1], "spawn") == 0) launch_mode = LAUNCH_SPAWN;
+		else if (strcmp(command->args[1], "fork") == 0) launch_mode = LAUNCH_FORK;
+		else {
+			printf("-%s: launcher: usage: launcher [spawn|fork]\n", sysname);
+			return SUCCESS;
+		}
+	}
+	printf("launcher: %s\n", launch_mode == LAUNCH_SPAWN ? "spawn" : "fork");
+	return SUCCESS;
+}
+
+// Function to start an external stage with posix_spawn; the child gets its
+// pipe ends, process group and default signals without a fork of the shell.
+// Process groups are only made when the shell controls a terminal.
+pid_t spawn_stage(struct command_t *stage, const char *path, int in_fd, int out_fd, pid_t pgid, bool foreground) {
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	sigset_t defaults, empty;
+	pid_t pid;
+
+	posix_spawn_file_actions_init(&actions);
+	if (in_fd != -1) posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+	if (out_fd != -1) posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+	for (struct redirect_t *redirect = stage->redirects; redirect; redirect = redirect->next) {
+		if (redirect->kind == REDIRECT_DUP) {
+			posix_spawn_file_actions_adddup2(&actions, redirect->dup_fd, redirect->fd);
+			continue;
+		}
+		int flags = redirect->kind == REDIRECT_IN ? O_RDONLY :
+			redirect->kind == REDIRECT_OUT ? O_WRONLY | O_CREAT | O_TRUNC : O_WRONLY | O_CREAT | O_APPEND;
+		posix_spawn_file_actions_addopen(&actions, redirect->fd, redirect->target, flags, 0666);
+	}
+	posix_spawnattr_init(&attr);
+	sigemptyset(&empty);
+	sigemptyset(&defaults);
+	sigaddset(&defaults, SIGINT);
+	sigaddset(&defaults, SIGQUIT);
+	sigaddset(&defaults, SIGTSTP);
+	sigaddset(&defaults, SIGTTIN);
+	sigaddset(&defaults, SIGTTOU);
+	short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+	if (shell_interactive) {
+		posix_spawnattr_setpgroup(&attr, pgid);
+		flags |= POSIX_SPAWN_SETPGROUP;
+#if defined(__GLIBC__)
+#if __GLIBC_PREREQ(2, 35)
+		// the first stage takes the terminal before exec, so it cannot read it too early
+		if (foreground && pgid == 0) posix_spawn_file_actions_addtcsetpgrp_np(&actions, STDIN_FILENO);
+#endif
+#endif
 	}
+	(void)foreground; // unused before glibc 2.35
+	posix_spawnattr_setsigdefault(&attr, &defaults);
+	posix_spawnattr_setsigmask(&attr, &empty);
+	posix_spawnattr_setflags(&attr, flags);
+
+	int r = posix_spawn(&pid, path, &actions, &attr, stage->args, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+	if (r != 0) {
+		errno = r;
+		return -1;
+	}
+	return pid;
+}
+
+// Function to run one pipeline stage inside its child process, never returns;
+// path is where the parent found an external command, NULL if it did not
+void run_stage(struct command_t *command, const char *path) {
+	/// This shows how to do exec with environ (but is not available on MacOs)
+	// extern char** environ; // environment variables
+	// execvpe(command->name, command->args, environ); // exec+args+path+environ
 
-	// TODO: your implementation here
+	// TODO: do your own exec with path resolving using execv() - done
 
-	printf("-%s: %s: command not found\n", sysname, command->name);
-	return UNKNOWN;
+	if(strcmp(command->name,"regression")==0){
+		regressionAndPlot(command);
+	}else if(strcmp(command->name, "hdiff")==0){
+		hdiff(command);
+	}else if(strcmp(command->name, "textify")==0){
+		textify(command);
+	}else if(strcmp(command->name, "hash")==0){
+		hash_builtin(command);
+	}else if(strcmp(command->name, "meter")==0){
+		meter(command);
+	}else if(strcmp(command->name, "compgen")==0){
+		compgen_builtin(command);
+	}else if(strcmp(command->name, "hstats")==0){
+		hstats_builtin(command);
+	}else if(strcmp(command->name, ":")==0){
+	}else if(path){
+		execv(path, command->args);
+		exit(127); // exec failed
+	}else{
+		printf("-%s: %s: command not found\n", sysname, command->name);
+		exit(127);
+	}
+	fflush(stdout);
+	exit(0);
 }
 
 void search_and_run_command(struct command_t *command, int issudo){
 	//PART 1
-	int exist_checker=0;
-	//getting path
-	char *path = getenv("PATH");
+	const char *checkedPath = hash_lookup(command->name);
+	if (checkedPath) {
+		if(issudo == 1) execv("/usr/bin/sudo", command->args);
+		else execv(checkedPath, command->args);
+	} else {
+		printf("-%s: %s: command not found\n", sysname, command->name);
+	}
+}
+
+// Function to hash a command name into a bucket of the hash table
+unsigned int hash_bucket(const char *name) {
+	unsigned int h = 2166136261u; // FNV-1a
+	while (*name) {
+		h ^= (unsigned char)*name++;
+		h *= 16777619u;
+	}
+	return h % HASH_BUCKETS;
+}
+
+// Function to drop all remembered command locations
+void hash_reset(void) {
+	for (int i = 0; i < HASH_BUCKETS; i++) {
+		struct hash_entry *entry = hash_table[i];
+		while (entry) {
+			struct hash_entry *next = entry->next;
+			free(entry->name);
+			free(entry->path);
+			free(entry);
+			entry = next;
+		}
+		hash_table[i] = NULL;
+	}
+	for (int i = 0; i < hash_dir_count; i++) free(hash_dirs[i].dir);
+	free(hash_dirs);
+	free(hash_path_value);
+	hash_dirs = NULL;
+	hash_dir_count = 0;
+	hash_path_value = NULL;
+}
+
+// Function to rebuild the directory list when PATH was reassigned
+void hash_sync_path(void) {
+	const char *path = getenv("PATH");
+	if (path == NULL) path = "";
+	if (hash_path_value && strcmp(hash_path_value, path) == 0) return;
+
+	hash_reset();
+	hash_path_value = strdup(path);
+	char *path_copy = strdup(path), *save = NULL;
+	for (char *dir = strtok_r(path_copy, ":", &save); dir; dir = strtok_r(NULL, ":", &save)) {
+		hash_dirs = realloc(hash_dirs, sizeof(struct hash_dir) * (hash_dir_count + 1));
+		hash_dirs[hash_dir_count].dir = strdup(dir);
+		hash_dirs[hash_dir_count].stamped = false;
+		hash_dir_count++;
+	}
+	free(path_copy);
+}
+
+// Function to forget the entries of one PATH directory
+void hash_drop_dir(int dir_index) {
+	for (int i = 0; i < HASH_BUCKETS; i++) {
+		struct hash_entry **link = &hash_table[i];
+		while (*link) {
+			struct hash_entry *entry = *link;
+			if (entry->dir_index == dir_index) {
+				*link = entry->next;
+				free(entry->name);
+				free(entry->path);
+				free(entry);
+			} else {
+				link = &entry->next;
+			}
+		}
+	}
+	hash_dirs[dir_index].stamped = false;
+}
+
+// Function to check whether a PATH directory changed since its entries were cached
+bool hash_dir_changed(int dir_index) {
+	struct stat st;
+	if (stat(hash_dirs[dir_index].dir, &st) != 0) return true;
+	return st.st_mtim.tv_sec != hash_dirs[dir_index].mtime.tv_sec ||
+		   st.st_mtim.tv_nsec != hash_dirs[dir_index].mtime.tv_nsec;
+}
+
+// Function to resolve a command name under PATH, remembering the result
+const char *hash_lookup(const char *name) {
+	static char direct_path[4096];
+	if (strchr(name, '/')) { // explicit path, no search needed
+		if (access(name, X_OK) != 0) return NULL;
+		snprintf(direct_path, sizeof(direct_path), "%s", name);
+		return direct_path;
+	}
+	if (*name == '\0') return NULL;
+
+	hash_sync_path();
+	unsigned int bucket = hash_bucket(name);
+	for (struct hash_entry *entry = hash_table[bucket]; entry; entry = entry->next) {
+		if (strcmp(entry->name, name) != 0) continue;
+		if (hash_dir_changed(entry->dir_index)) {
+			hash_drop_dir(entry->dir_index); // directory was modified, search again
+			break;
+		}
+		entry->hits++;
+		return entry->path;
+	}
+
 	char checkedPath[4096];
-	char* pTokens = strtok(path, ":");
-	
-	while(pTokens!=NULL){
+	for (int i = 0; i < hash_dir_count; i++) {
 		//building path to command
-		snprintf(checkedPath, sizeof(checkedPath), "%s/%s", pTokens, command->name);
-       //check if there is an accesible file
-        if (access(checkedPath, X_OK) == 0) {
-            exist_checker = 1;
-            break;
-        }
-        pTokens = strtok(NULL, ":");
+		snprintf(checkedPath, sizeof(checkedPath), "%s/%s", hash_dirs[i].dir, name);
+		//check if there is an accesible file
+		if (access(checkedPath, X_OK) != 0) continue;
+
+		struct stat st;
+		if (!hash_dirs[i].stamped && stat(hash_dirs[i].dir, &st) == 0) {
+			hash_dirs[i].mtime = st.st_mtim;
+			hash_dirs[i].stamped = true;
+		}
+		struct hash_entry *entry = calloc(1, sizeof(struct hash_entry));
+		entry->name = strdup(name);
+		entry->path = strdup(checkedPath);
+		entry->dir_index = i;
+		entry->hits = 1;
+		entry->next = hash_table[bucket];
+		hash_table[bucket] = entry;
+		return entry->path;
 	}
-	if (exist_checker) {
-		if(issudo == 1) execv("/usr/bin/sudo", command->args);
-		else execv(checkedPath, command->args);
-    } else {
-        printf("-%s: %s: command not found\n", sysname, command->name);
-    }
+	return NULL;
 }
 
-// Function to perform program piping for Part-2
-int pipe_function(struct command_t *command){
-	//Create a pipe
-    int fd[2];
-	if (pipe(fd) == -1) {
-		fprintf(stderr,"Pipe failed");
-		return EXIT;
+// Builtin "hash": list the table, "hash -r" empties it, "hash <name>..." adds names
+int hash_builtin(struct command_t *command) {
+	if (command->arg_count > 2 && strcmp(command->args[1], "-r") == 0) {
+		hash_reset();
+		return SUCCESS;
 	}
-	
-	//First child
-	pid_t left = fork();
-	if(left == 0){
-    	close(1);
-    	//Close read end
-    	close(fd[0]);
-    	// Redirect stdout to the write end of the pipe:
-    	dup2(fd[1],1);
-    	//Close write end
-		close(fd[1]); 
-		search_and_run_command(command,0); //running command
-	}
-
-	//Second child
-	pid_t right = fork();
-	if(right == 0){
-       	close(0);
-       	close(fd[1]);
-       	// Redirect stdin to the read end of the pipe
-       	dup2(fd[0],0);
-		close(fd[0]);
-		process_command(command->next); //Possible recursive
-		exit(0);
-    	}
-    	
-	//Parent process
-	close(fd[0]);
-	close(fd[1]);
-	//Wait children to finish:
-	waitpid(left,NULL,0);
-	waitpid(right,NULL,0);
+	if (command->arg_count > 2) {
+		for (int i = 1; command->args[i] != NULL; i++) {
+			if (hash_lookup(command->args[i]) == NULL)
+				printf("-%s: hash: %s: not found\n", sysname, command->args[i]);
+		}
+		return SUCCESS;
+	}
+
+	int shown = 0;
+	for (int i = 0; i < HASH_BUCKETS; i++) {
+		for (struct hash_entry *entry = hash_table[i]; entry; entry = entry->next) {
+			if (shown++ == 0) printf("hits\tcommand\n");
+			printf("%4d\t%s\n", entry->hits, entry->path);
+		}
+	}
+	if (shown == 0) printf("%s: hash table empty\n", sysname);
 	return SUCCESS;
 }
 
+// Function to run a command and every stage piped after it. All stages are
+// forked from this shell in one loop into a single process group, connected
+// with close-on-exec pipes, and reaped here; a lone command is a 1-stage pipeline.
+int pipe_function(struct command_t *command){
+	int stage_count = 0;
+	for (struct command_t *stage = command; stage; stage = stage->next) stage_count++;
 
-// Function to combine a directory path and a file name into a single path
-void combine_paths(char *result, const char *directory, const char *file) {
-	// Check if directory or file is NULL or empty
-	if (!directory || !file || !*directory || !*file) {
-		// If either directory or file is NULL or empty, copy the non-empty one to result
-		strcpy(result, directory ? directory : file ? file : "");
-	} else {
-		// If both directory and file are not NULL or empty, concatenate them with a separator
-		sprintf(result, "%s%s%s", directory, directory[strlen(directory) - 1] == '/' ? "" : "/", file);
+	// look each name up once, here, so the hash table keeps the hits; copied
+	// because an explicit path is returned in a buffer the next lookup reuses
+	char *paths[stage_count];
+	int stage_index = 0;
+	for (struct command_t *stage = command; stage; stage = stage->next) {
+		const char *found = is_child_builtin(stage->name) ? NULL : hash_lookup(stage->name);
+		paths[stage_index++] = found ? strdup(found) : NULL;
+	}
+
+	pid_t pids[stage_count];
+	pid_t pgid = 0;
+	int in_fd = -1; // read end feeding the current stage
+	bool foreground = !command->background && shell_interactive;
+	int forked = 0;
+	fflush(stdout); // so forked children do not inherit pending output
+
+	stage_index = 0;
+	for (struct command_t *stage = command; stage; stage = stage->next) {
+		const char *path = paths[stage_index++];
+		int fd[2] = {-1, -1};
+		if (stage->next && pipe2(fd, O_CLOEXEC) == -1) {
+			fprintf(stderr, "-%s: pipe: %s\n", sysname, strerror(errno));
+			break;
+		}
+
+		// plain external commands are spawned, builtins and unknown names are forked
+		bool spawned = launch_mode == LAUNCH_SPAWN && path;
+		pid_t pid = spawned ? spawn_stage(stage, path, in_fd, fd[1], pgid, foreground) : fork();
+		if (pid == -1 && spawned && stage->redirects) { // let a forked child report which redirection failed
+			spawned = false;
+			pid = fork();
+		}
+		if (pid == -1) {
+			fprintf(stderr, "-%s: %s: %s\n", sysname, spawned ? stage->name : "fork", strerror(errno));
+			if (fd[0] != -1) {
+				close(fd[0]);
+				close(fd[1]);
+			}
+			break;
+		}
+		if (pid == 0) {
+			if (shell_interactive) setpgid(0, pgid); // a script's children stay in the shell's group
+			if (foreground) tcsetpgrp(STDIN_FILENO, getpgrp());
+			reset_child_signals();
+			if (in_fd != -1) { // Redirect stdin to the read end of the previous pipe
+				dup2(in_fd, STDIN_FILENO);
+				close(in_fd);
+			}
+			if (fd[1] != -1) { // Redirect stdout to the write end of the pipe
+				dup2(fd[1], STDOUT_FILENO);
+				close(fd[1]);
+				close(fd[0]); // builtins do not exec, so close explicitly
+			}
+			if (apply_redirects(stage) != 0) exit(1);
+			run_stage(stage, path);
+		}
+
+		//Parent process
+		if (pgid == 0) {
+			pgid = pid;
+			if (foreground) tcsetpgrp(STDIN_FILENO, pgid); // a spawned child cannot take it itself
+		}
+		if (shell_interactive) setpgid(pid, pgid); // also set here to win the race against the child
+		pids[forked++] = pid;
+		if (in_fd != -1) close(in_fd);
+		if (fd[1] != -1) close(fd[1]);
+		in_fd = fd[0];
+	}
+	if (in_fd != -1) close(in_fd);
+	for (int i = 0; i < stage_count; i++) free(paths[i]);
+	if (forked == 0) return SUCCESS;
+
+	struct job *job = add_job(command, pgid, pids, forked);
+	if (command->background) {
+		if (shell_interactive) printf("[%d] %d\n", job->id, (int)pgid);
+		return SUCCESS;
 	}
+	wait_for_job(job);
+	return SUCCESS;
 }
 
+// Function to restore the signal setup a forked child should start with
+void reset_child_signals(void) {
+	sigset_t empty;
+	signal(SIGINT, SIG_DFL);
+	signal(SIGQUIT, SIG_DFL);
+	signal(SIGTSTP, SIG_DFL);
+	signal(SIGTTIN, SIG_DFL);
+	signal(SIGTTOU, SIG_DFL);
+	sigemptyset(&empty);
+	sigprocmask(SIG_SETMASK, &empty, NULL);
+}
 
-int check_command_or_filename(char *buf, char *filename_start) {
-	const char *splitters = " \t"; 
-	int len = strlen(buf);
-	int flag = 0;
-	while(len>0 && strchr(splitters,buf[0]) != NULL) {  
-		buf++;
-		len--;
+// Function to rebuild the text of a command line for the job table
+char *command_text(struct command_t *command) {
+	size_t len = 1;
+	for (struct command_t *stage = command; stage; stage = stage->next) {
+		for (int i = 0; stage->args[i]; i++) len += strlen(stage->args[i]) + 3;
+		for (struct redirect_t *redirect = stage->redirects; redirect; redirect = redirect->next)
+			len += (redirect->target ? strlen(redirect->target) : 0) + 32;
 	}
-	while(len>0 && strchr(splitters,buf[len-1]) != NULL) {
-		buf[--len] = 0; 
-		flag = 1;
+	char *text = calloc(len + 2, 1);
+	for (struct command_t *stage = command; stage; stage = stage->next) {
+		for (int i = 0; stage->args[i]; i++) {
+			if (i > 0) strcat(text, " ");
+			strcat(text, stage->args[i]);
+		}
+		for (struct redirect_t *redirect = stage->redirects; redirect; redirect = redirect->next) {
+			if (redirect->kind == REDIRECT_DUP) sprintf(text + strlen(text), " %d>&%d", redirect->fd, redirect->dup_fd);
+			else sprintf(text + strlen(text), " %d%s%s", redirect->fd, redirect->kind == REDIRECT_IN ? "<" :
+						 redirect->kind == REDIRECT_OUT ? ">" : ">>", redirect->target);
+		}
+		if (stage->next) strcat(text, " | ");
 	}
-	char *tokch = strtok(buf,splitters);
-	if(tokch == NULL) return 0;
+	if (command->background) strcat(text, " &");
+	return text;
+}
 
-	if(flag) {
-		filename_start[0] = '\0';
-		return 1;
+// Function to add a started pipeline to the job table
+struct job *add_job(struct command_t *command, pid_t pgid, pid_t *pids, int stage_count) {
+	struct job *job = calloc(1, sizeof(struct job));
+	job->id = 1;
+	for (int i = 0; i < job_count; i++)
+		if (jobs[i]->id >= job->id) job->id = jobs[i]->id + 1;
+	job->pgid = pgid;
+	job->pids = malloc(sizeof(pid_t) * stage_count);
+	memcpy(job->pids, pids, sizeof(pid_t) * stage_count);
+	job->stage_count = job->alive = stage_count;
+	job->state = JOB_RUNNING;
+	job->started = now_seconds();
+	job->command_line = command_text(command);
+	job->stage_names = malloc(sizeof(char *) * stage_count);
+	struct command_t *stage = command;
+	for (int i = 0; i < stage_count; i++, stage = stage->next) job->stage_names[i] = strdup(stage->name);
+	job->stage_usage = calloc(stage_count, sizeof(struct rusage));
+	job->stage_finished = calloc(stage_count, sizeof(double));
+	job->timed = command->timed;
+	jobs_started++;
+	jobs = realloc(jobs, sizeof(struct job *) * (job_count + 1));
+	jobs[job_count++] = job;
+	return job;
+}
+
+void remove_job(struct job *job) {
+	for (int i = 0; i < job_count; i++) {
+		if (jobs[i] != job) continue;
+		memmove(&jobs[i], &jobs[i + 1], sizeof(struct job *) * (job_count - i - 1));
+		job_count--;
+		break;
 	}
-	tokch = strtok(NULL,splitters);
+	if (job->timed && job->state == JOB_DONE) print_job_usage(job);
+	for (int i = 0; i < job->stage_count; i++) free(job->stage_names[i]);
+	free(job->stage_names);
+	free(job->stage_usage);
+	free(job->stage_finished);
+	free(job->pids);
+	free(job->command_line);
+	free(job);
+}
 
-	if(tokch == NULL) { // check for command case
-		strcpy(filename_start, buf);
-		return 0;
-	};
-	char *last_token = tokch;
-	while((tokch=strtok(NULL,splitters)) != NULL){ // trim string until char
-		last_token=tokch;
-		if(last_token[strlen(last_token)-1] == '|') { // check for command case after pipe
-			tokch=strtok(NULL,splitters);
-			last_token=tokch;
-			strcpy(filename_start, last_token);
-			return 0;
+// Function to find the job a process belongs to
+struct job *find_job_by_pid(pid_t pid) {
+	for (int i = 0; i < job_count; i++)
+		for (int j = 0; j < jobs[i]->stage_count; j++)
+			if (jobs[i]->pids[j] == pid) return jobs[i];
+	return NULL;
+}
+
+// Function to record a status change reported by wait4
+void update_job(struct job *job, pid_t pid, int status, struct rusage *usage) {
+	if (WIFSTOPPED(status)) {
+		job->state = JOB_STOPPED;
+	} else if (WIFCONTINUED(status)) {
+		job->state = JOB_RUNNING;
+	} else {
+		job->alive--;
+		job->usage.ru_utime.tv_sec += usage->ru_utime.tv_sec;
+		job->usage.ru_utime.tv_usec += usage->ru_utime.tv_usec;
+		job->usage.ru_stime.tv_sec += usage->ru_stime.tv_sec;
+		job->usage.ru_stime.tv_usec += usage->ru_stime.tv_usec;
+		job->usage.ru_nvcsw += usage->ru_nvcsw;
+		job->usage.ru_nivcsw += usage->ru_nivcsw;
+		if (usage->ru_maxrss > job->usage.ru_maxrss) job->usage.ru_maxrss = usage->ru_maxrss;
+		if (pid == job->pids[job->stage_count - 1]) job->status = status;
+		for (int i = 0; i < job->stage_count; i++) {
+			if (job->pids[i] != pid) continue;
+			job->stage_usage[i] = *usage;
+			job->stage_finished[i] = now_seconds();
+			record_command_stats(job->stage_names[i], job->stage_finished[i] - job->started, usage);
 		}
-	} 
-	strcpy(filename_start, last_token);
-	return 1; // check for file case
+		if (job->alive == 0) {
+			job->state = JOB_DONE;
+			job->finished = now_seconds();
+		}
+	}
 }
 
-// Function to search and save all commands under PATH together with custom commands
-void save_available_commands(const char *file_name) {
-	FILE *file = fopen(file_name, "w");
-	if (file == NULL){
-		perror("Error opening the txt file");
-		return;
+// Function to reap every child that changed state, called when signalfd fires
+void reap_jobs(void) {
+	struct signalfd_siginfo info[16];
+	ssize_t n;
+	while ((n = read(sigchld_fd, info, sizeof(info))) > 0) { // signals coalesce, so just drain
+		for (size_t i = 0; i < n / sizeof(info[0]); i++)
+			if (info[i].ssi_signo == SIGWINCH) editor.columns = 0; // measured again by the editor
 	}
-    
-	char *path = strdup(getenv("PATH"));
-	int num = 0;
-	char *all_commands[10000];
-	char *path_tokenizer = strtok(path, ":");
-	while (path_tokenizer != NULL){
-		DIR *directory;
-		struct dirent *directory_entry;
-		directory = opendir(path_tokenizer);
-        	if (directory){
-			while ((directory_entry = readdir(directory)) != NULL){
-				if (directory_entry->d_name[0] == '.') continue;
-				char full_path[strlen(path_tokenizer) + strlen(directory_entry->d_name) + 1];
-				combine_paths(full_path, path_tokenizer, directory_entry->d_name);
-		            	if (access(full_path, X_OK) != 0) continue;
-		            		int duplicate = 0;
-					for (int i = 0; i < num; i++){
-						if (strcmp(all_commands[i], directory_entry->d_name) == 0){
-							duplicate = 1;
-							break;
-						}
-					}
-					if (!duplicate){
-						fprintf(file, "%s\n", directory_entry->d_name);
-						all_commands[num++] = strdup(directory_entry->d_name);
-					}
-				}
-		        		closedir(directory);
-        	}
-        	path_tokenizer = strtok(NULL, ":");
+
+	int status;
+	struct rusage usage;
+	pid_t pid;
+	while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage)) > 0) {
+		struct job *job = find_job_by_pid(pid);
+		if (job) update_job(job, pid, status, &usage);
 	}
-	int num_cmds = sizeof(builtin_command_list) / sizeof(builtin_command_list[0]);
-	for(int i=0;i<num_cmds;i++) fprintf(file, "%s\n", builtin_command_list[i]); // add the built in commands
-	fclose(file);
-	free(path);
-	for (int i = 0; i < num; i++) free(all_commands[i]);	
 }
 
+// Function to print one line of resource usage for time
+void print_usage(const char *label, double wall, struct rusage *usage) {
+	fprintf(stderr, "%-12s real %.3fs  user %.3fs  sys %.3fs  maxrss %ld KiB  ctxsw %ld/%ld\n", label, wall,
+			usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6, usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6,
+			usage->ru_maxrss, usage->ru_nvcsw, usage->ru_nivcsw);
+}
 
-// Function to autocomplete commands based on input string
-struct autocomplete_struct *command_complete(const char *input_str) {
-	int num_matches = 0; // Number of matches found
-	struct autocomplete_struct *match = calloc(1, sizeof(struct autocomplete_struct)); // Allocate memory for match struct
-	FILE *file = fopen("all_commands.txt", "r"); // Open file containing all commands
-	if (file == NULL) {
-		perror("Error opening file");
-		return match;
-	}
-	char command[300]; // Buffer to read each command line
-	while (fgets(command, sizeof(command), file)) {
-		command[strcspn(command, "\n")] = '\0';
-        	if (strncmp(command, input_str, strlen(input_str)) == 0) {
-			match->matches = (char **)realloc(match->matches, sizeof(char *) * (num_matches + 1)); // Check if command matches input string
-			match->matches[num_matches] = (char *)calloc(strlen(command) + 1, 1); // Resize matches array to accommodate new match
-			strcpy(match->matches[num_matches++], command); // Copy matched command to matches array
-		}
-	}
-	fclose(file);
-	match->count = num_matches;
-	return match;
+// Function to report what a finished timed job used, per stage for a pipeline
+void print_job_usage(struct job *job) {
+	if (job->stage_count > 1)
+		for (int i = 0; i < job->stage_count; i++)
+			print_usage(job->stage_names[i], job->stage_finished[i] - job->started, &job->stage_usage[i]);
+	print_usage(job->stage_count > 1 ? "total" : job->stage_names[0], job->finished - job->started, &job->usage);
 }
 
+// Function to add a finished process to the session statistics of its command
+void record_command_stats(const char *name, double wall, struct rusage *usage) {
+	struct command_stats *stats = NULL;
+	for (int i = 0; i < command_stats_count && stats == NULL; i++)
+		if (strcmp(command_stats[i].name, name) == 0) stats = &command_stats[i];
+	if (stats == NULL) {
+		command_stats = realloc(command_stats, sizeof(struct command_stats) * (command_stats_count + 1));
+		stats = &command_stats[command_stats_count++];
+		memset(stats, 0, sizeof(struct command_stats));
+		stats->name = strdup(name);
+	}
+	stats->count++;
+	stats->wall += wall;
+	if (wall > stats->max_wall) stats->max_wall = wall;
+	stats->user += usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6;
+	stats->sys += usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6;
+	if (usage->ru_maxrss > stats->max_rss) stats->max_rss = usage->ru_maxrss;
+	stats->voluntary += usage->ru_nvcsw;
+	stats->involuntary += usage->ru_nivcsw;
+	int bucket = 0;
+	for (double ms = wall * 1000; ms >= 1 && bucket < HSTATS_BUCKETS - 1; ms /= 2) bucket++;
+	stats->histogram[bucket]++;
+}
 
-// Function to autocomplete directories based on input string
-struct autocomplete_struct *directory_complete(const char *input_str) {
-	int num_matches = 0; // Number of matches found
-	struct autocomplete_struct *match = calloc(1, sizeof(struct autocomplete_struct)); // Allocate memory for match struct
-	DIR *directory = opendir("."); // Open current directory
-	struct dirent *dir; // Directory entry struct
-	if (directory) {
-		while ((dir = readdir(directory)) != NULL) { // Read each directory entry
-			if (strncmp(dir->d_name, input_str, strlen(input_str)) == 0) { // Check if directory name matches input string
-				match->matches = (char **) realloc(match->matches, sizeof(char *) * (num_matches + 1));
-				match->matches[num_matches] = (char *)calloc(strlen(dir->d_name) + 1, 1);
-				if(dir->d_type != DT_DIR) {
-					char *copy = (char *)calloc(strlen(dir->d_name) + 1, 1);
-					strcpy(copy, dir->d_name);
-					strcpy(match->matches[num_matches++], copy);
-					free(copy);
-				}else if(dir->d_type == DT_DIR && strcmp(dir->d_name,".")!=0 && strcmp(dir->d_name,"..")!=0) {
-					char *copy = (char *)calloc(strlen(dir->d_name) + 2, 1); // Allocate memory for for copy with an extra '/' char
-					strcpy(copy, dir->d_name);
-					copy[strlen(dir->d_name)] = '/';
-					copy[strlen(dir->d_name)+1] = '\0';
-					strcpy(match->matches[num_matches++], copy); // Copy the copy to the matches array
-					free(copy);
-				}
-			}
+int compare_stats_wall(const void *a, const void *b) {
+	double x = ((const struct command_stats *)a)->wall, y = ((const struct command_stats *)b)->wall;
+	return x < y ? 1 : x > y ? -1 : 0;
+}
+
+// Builtin "hstats": resources used per command name this session, most
+// expensive first. "hstats name" draws the wall time histogram of one
+// command and "hstats -r" forgets everything.
+int hstats_builtin(struct command_t *command) {
+	reap_jobs();
+	const char *only = command->arg_count > 2 ? command->args[1] : NULL;
+	if (only && strcmp(only, "-r") == 0) {
+		for (int i = 0; i < command_stats_count; i++) free(command_stats[i].name);
+		command_stats_count = 0;
+		return SUCCESS;
+	}
+	qsort(command_stats, command_stats_count, sizeof(struct command_stats), compare_stats_wall);
+	if (only == NULL) {
+		static const char shades[] = " .:-=+*#";
+		printf("%-16s %6s %10s %10s %10s %9s %9s %9s %11s  wall <1ms..16s+\n",
+			   "command", "runs", "total", "mean", "max", "user", "sys", "maxrss", "ctxsw");
+		for (int i = 0; i < command_stats_count; i++) {
+			struct command_stats *stats = &command_stats[i];
+			unsigned long peak = 1;
+			for (int b = 0; b < HSTATS_BUCKETS; b++) if (stats->histogram[b] > peak) peak = stats->histogram[b];
+			char histogram[HSTATS_BUCKETS + 1];
+			for (int b = 0; b < HSTATS_BUCKETS; b++) // darker is more runs
+				histogram[b] = stats->histogram[b] ? shades[1 + (stats->histogram[b] * 6) / peak] : shades[0];
+			histogram[HSTATS_BUCKETS] = '\0';
+			printf("%-16s %6lu %9.3fs %8.1fms %8.1fms %8.3fs %8.3fs %6ldKiB %5ld/%-5ld  |%s|\n",
+				   stats->name, stats->count, stats->wall, stats->wall / stats->count * 1000, stats->max_wall * 1000,
+				   stats->user, stats->sys, stats->max_rss, stats->voluntary, stats->involuntary, histogram);
+		}
+		return SUCCESS;
+	}
+	for (int i = 0; i < command_stats_count; i++) {
+		struct command_stats *stats = &command_stats[i];
+		if (strcmp(stats->name, only) != 0) continue;
+		unsigned long peak = 1;
+		for (int b = 0; b < HSTATS_BUCKETS; b++) if (stats->histogram[b] > peak) peak = stats->histogram[b];
+		for (int b = 0; b < HSTATS_BUCKETS; b++) {
+			char range[32];
+			if (b == 0) snprintf(range, sizeof(range), "<1ms");
+			else if (b == HSTATS_BUCKETS - 1) snprintf(range, sizeof(range), ">=%dms", 1 << (b - 1));
+			else snprintf(range, sizeof(range), "%d-%dms", 1 << (b - 1), 1 << b);
+			int width = stats->histogram[b] * 40 / peak;
+			printf("%12s %6lu %.*s\n", range, stats->histogram[b], width, "########################################");
 		}
-        closedir(directory);
+		return SUCCESS;
 	}
-	match->count = num_matches;
-	return match;
+	printf("-%s: hstats: %s: no runs recorded\n", sysname, only);
+	return SUCCESS;
 }
 
+// Function to describe the state of a job for jobs and notifications
+void print_job(struct job *job) {
+	double user = job->usage.ru_utime.tv_sec + job->usage.ru_utime.tv_usec / 1e6;
+	double sys = job->usage.ru_stime.tv_sec + job->usage.ru_stime.tv_usec / 1e6;
+	double wall = (job->state == JOB_DONE ? job->finished : now_seconds()) - job->started;
+	char state[32];
+	if (job->state == JOB_RUNNING) strcpy(state, "Running");
+	else if (job->state == JOB_STOPPED) strcpy(state, "Stopped");
+	else if (WIFSIGNALED(job->status)) snprintf(state, sizeof(state), "Killed (%s)", strsignal(WTERMSIG(job->status)));
+	else if (WEXITSTATUS(job->status) != 0) snprintf(state, sizeof(state), "Exit %d", WEXITSTATUS(job->status));
+	else strcpy(state, "Done");
+	printf("[%d]  %-20s wall %.2fs user %.2fs sys %.2fs  %s\n", job->id, state, wall, user, sys, job->command_line);
+}
 
-void regressionAndPlot(struct command_t *command){
-    char* filename;
-    int regressionType=1;
-    int degree;
-    
-    //Read from command:
-    if(command->arg_count==3){
-   	 filename=command->args[1];
-    }
-    else if(command->arg_count==5){
-   	 filename=command->args[1];
-   	 degree=atoi(command->args[3]);
-   	 if (strcmp(command->args[2], "-p")==0){
-   		 regressionType=2;
-   	 }
-    }
-    else{
-   	 printf("Number of arguments are not correct\n");
-   	 return;
-    }
-    
-    FILE *fp;
-    double x[100], y[100];
-    int n = 0; // Number of data points
-    fp = fopen(filename, "r");
-    if (fp == NULL){
-   	 printf("Error opening file!\n");
-    }
-    // Read data points from file
-    printf("Data Points:\n");
-    printf("x\t y\n");
-    while (fscanf(fp, "%lf %lf", &x[n], &y[n]) == 2){
+// Function to report and forget the jobs that finished since the last prompt
+void notify_jobs(bool report) {
+	reap_jobs();
+	for (int i = 0; i < job_count;) {
+		if (jobs[i]->state == JOB_DONE) {
+			if (report) print_job(jobs[i]);
+			remove_job(jobs[i]);
+		} else {
+			i++;
+		}
+	}
+}
+
+// Function to send a signal to every stage of a job: to its process group
+// when it has one, else to each stage that was not reaped yet
+int signal_job(struct job *job, int sig) {
+	if (shell_interactive) return kill(-job->pgid, sig);
+	int r = 0;
+	for (int i = 0; i < job->stage_count; i++)
+		if (job->stage_finished[i] == 0 && kill(job->pids[i], sig) == -1) r = -1;
+	return r;
+}
+
+// Function to wait for one state change in a job until it is done or
+// stopped. Without process groups any child can report first, so each is
+// recorded in its own job.
+void wait_job_change(struct job *job) {
+	while (job->alive > 0 && job->state != JOB_STOPPED) {
+		int status;
+		struct rusage usage;
+		pid_t pid = wait4(shell_interactive ? -job->pgid : -1, &status, WUNTRACED, &usage);
+		if (pid == -1) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		struct job *owner = find_job_by_pid(pid);
+		if (owner) update_job(owner, pid, status, &usage);
+	}
+}
+
+// Function to give the terminal to a job and wait until it finishes or stops
+void wait_for_job(struct job *job) {
+	if (shell_interactive) tcsetpgrp(STDIN_FILENO, job->pgid);
+	wait_job_change(job);
+	if (shell_interactive) tcsetpgrp(STDIN_FILENO, shell_pgid);
+
+	if (job->state == JOB_STOPPED) {
+		printf("\n");
+		print_job(job);
+		last_status = 128 + SIGTSTP;
+		return;
+	}
+	if (WIFSIGNALED(job->status)) {
+		if (WTERMSIG(job->status) == SIGINT) printf("\n");
+		last_status = 128 + WTERMSIG(job->status);
+	} else {
+		last_status = WEXITSTATUS(job->status);
+	}
+	remove_job(job);
+}
+
+// Function to resolve a job spec such as %2 or %% (the most recent job)
+struct job *find_job(const char *spec) {
+	if (job_count == 0) return NULL;
+	if (spec == NULL || strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0 || strcmp(spec, "%") == 0)
+		return jobs[job_count - 1];
+	if (spec[0] == '%') spec++;
+	char *end;
+	long id = strtol(spec, &end, 10);
+	if (*end != '\0') return NULL;
+	for (int i = 0; i < job_count; i++)
+		if (jobs[i]->id == id) return jobs[i];
+	return NULL;
+}
+
+// Builtin "jobs": list running, stopped and newly finished jobs
+int jobs_builtin(struct command_t *command) {
+	(void)command;
+	reap_jobs();
+	for (int i = 0; i < job_count;) {
+		print_job(jobs[i]);
+		if (jobs[i]->state == JOB_DONE) remove_job(jobs[i]);
+		else i++;
+	}
+	return SUCCESS;
+}
+
+// Function to wait until every stage of a job exited and forget the job.
+// A stopped job would never finish, so like bash it is reported and kept,
+// and false is returned.
+bool finish_job(struct job *job) {
+	wait_job_change(job);
+	if (job->state == JOB_STOPPED) {
+		print_job(job);
+		last_status = 128 + SIGTSTP;
+		return false;
+	}
+	last_status = WIFSIGNALED(job->status) ? 128 + WTERMSIG(job->status) : WEXITSTATUS(job->status);
+	remove_job(job);
+	return true;
+}
+
+// Builtin "wait [%n|pid ...]": wait for the given jobs, or for all of them
+int wait_builtin(struct command_t *command) {
+	if (command->arg_count <= 2) {
+		for (int i = 0; i < job_count;)
+			if (!finish_job(jobs[i])) i++; // stopped, go on with the next job
+		return SUCCESS;
+	}
+	for (int i = 1; command->args[i]; i++) {
+		struct job *job = command->args[i][0] == '%' ? find_job(command->args[i]) :
+			find_job_by_pid(atoi(command->args[i]));
+		if (job == NULL) printf("-%s: wait: %s: no such job\n", sysname, command->args[i]);
+		else finish_job(job);
+	}
+	return SUCCESS;
+}
+
+// Builtin "fg [%n]": continue a job in the foreground
+int fg_builtin(struct command_t *command) {
+	struct job *job = find_job(command->arg_count > 2 ? command->args[1] : NULL);
+	if (job == NULL) {
+		printf("-%s: fg: no such job\n", sysname);
+		return SUCCESS;
+	}
+	printf("%s\n", job->command_line);
+	if (shell_interactive) tcsetpgrp(STDIN_FILENO, job->pgid);
+	signal_job(job, SIGCONT);
+	job->state = JOB_RUNNING;
+	wait_for_job(job);
+	return SUCCESS;
+}
+
+// Builtin "bg [%n]": continue a stopped job in the background
+int bg_builtin(struct command_t *command) {
+	struct job *job = find_job(command->arg_count > 2 ? command->args[1] : NULL);
+	if (job == NULL) {
+		printf("-%s: bg: no such job\n", sysname);
+		last_status = 1;
+		return SUCCESS;
+	}
+	signal_job(job, SIGCONT);
+	job->state = JOB_RUNNING;
+	printf("[%d] %s &\n", job->id, job->command_line);
+	last_status = 0; // not the 148 of the stop that made bg necessary
+	return SUCCESS;
+}
+
+// Function to turn a signal name or number such as TERM, SIGKILL or 9 into a number
+int parse_signal(const char *name) {
+	static const struct { const char *name; int number; } signals[] = {
+		{"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"KILL", SIGKILL},
+		{"USR1", SIGUSR1}, {"USR2", SIGUSR2}, {"PIPE", SIGPIPE}, {"ALRM", SIGALRM},
+		{"TERM", SIGTERM}, {"CONT", SIGCONT}, {"STOP", SIGSTOP}, {"TSTP", SIGTSTP},
+	};
+	if (isdigit((unsigned char)name[0])) return atoi(name);
+	if (strncmp(name, "SIG", 3) == 0) name += 3;
+	for (size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); i++)
+		if (strcasecmp(signals[i].name, name) == 0) return signals[i].number;
+	return -1;
+}
+
+// Builtin "kill [-SIG | -s SIG] %n|pid ...": signal jobs or processes
+int kill_builtin(struct command_t *command) {
+	int sig = SIGTERM, i = 1;
+	if (command->args[i] && strcmp(command->args[i], "-s") == 0 && command->args[i + 1]) {
+		sig = parse_signal(command->args[i + 1]);
+		i += 2;
+	} else if (command->args[i] && command->args[i][0] == '-') {
+		sig = parse_signal(command->args[i] + 1);
+		i++;
+	}
+	if (sig < 0 || command->args[i] == NULL) {
+		printf("-%s: kill: usage: kill [-SIG | -s SIG] %%n|pid ...\n", sysname);
+		return SUCCESS;
+	}
+	for (; command->args[i]; i++) {
+		int r;
+		if (command->args[i][0] == '%') {
+			struct job *job = find_job(command->args[i]);
+			if (job == NULL) {
+				printf("-%s: kill: %s: no such job\n", sysname, command->args[i]);
+				continue;
+			}
+			r = signal_job(job, sig);
+			if (r == 0 && job->state == JOB_STOPPED && sig != SIGSTOP) signal_job(job, SIGCONT); // let it see the signal
+		} else {
+			r = kill(atoi(command->args[i]), sig);
+		}
+		if (r == -1) printf("-%s: kill: %s: %s\n", sysname, command->args[i], strerror(errno));
+	}
+	return SUCCESS;
+}
+
+
+// Function to get a monotonic timestamp in seconds
+double now_seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Function to wait until fd is ready for events, returning the time spent waiting
+double meter_wait(int fd, short events) {
+	struct pollfd pfd = {fd, events, 0};
+	double start = now_seconds();
+	while (poll(&pfd, 1, -1) == -1 && errno == EINTR);
+	return now_seconds() - start;
+}
+
+// Builtin "meter [label]": a pipeline stage that passes its input through
+// unchanged and reports the flow when the input ends. Data moves pipe to
+// pipe with splice(), so it is counted without being copied to user space.
+// Time blocked on an empty input is upstream stall, time blocked on a full
+// output is downstream stall.
+void meter(struct command_t *command) {
+	const char *label = command->arg_count > 2 ? command->args[1] : "meter";
+	unsigned long long total = 0;
+	double upstream_stall = 0, downstream_stall = 0;
+	double start = now_seconds();
+	bool use_splice = true;
+	char buf[65536];
+	signal(SIGPIPE, SIG_IGN); // report even when the consumer quits early
+
+	while (1) {
+		ssize_t n;
+		if (use_splice) {
+			n = splice(STDIN_FILENO, NULL, STDOUT_FILENO, NULL, 1 << 20,
+					   SPLICE_F_MOVE | SPLICE_F_MORE | SPLICE_F_NONBLOCK);
+			if (n == -1 && errno == EINVAL) { // neither end is a pipe, e.g. a terminal
+				use_splice = false;
+				continue;
+			}
+			if (n == -1 && errno == EAGAIN) {
+				struct pollfd in = {STDIN_FILENO, POLLIN, 0};
+				if (poll(&in, 1, 0) == 0) upstream_stall += meter_wait(STDIN_FILENO, POLLIN);
+				else downstream_stall += meter_wait(STDOUT_FILENO, POLLOUT);
+				continue;
+			}
+		} else {
+			double wait_start = now_seconds();
+			n = read(STDIN_FILENO, buf, sizeof(buf));
+			upstream_stall += now_seconds() - wait_start;
+			for (ssize_t off = 0; n > 0 && off < n;) {
+				wait_start = now_seconds();
+				ssize_t w = write(STDOUT_FILENO, buf + off, n - off);
+				downstream_stall += now_seconds() - wait_start;
+				if (w == -1 && errno != EINTR) {
+					n = -1;
+					break;
+				}
+				if (w > 0) off += w;
+			}
+		}
+		if (n == -1 && errno == EINTR) continue;
+		if (n <= 0) break; // end of input, or the consumer went away
+		total += n;
+	}
+
+	double elapsed = now_seconds() - start;
+	fprintf(stderr, "%s: %llu bytes in %.3f s, %.2f MiB/s, upstream stall %.3f s, downstream stall %.3f s\n",
+			label, total, elapsed, elapsed > 0 ? total / elapsed / (1024.0 * 1024.0) : 0.0,
+			upstream_stall, downstream_stall);
+}
+
+
+// Function to combine a directory path and a file name into a single path
+void combine_paths(char *result, const char *directory, const char *file) {
+	// Check if directory or file is NULL or empty
+	if (!directory || !file || !*directory || !*file) {
+		// If either directory or file is NULL or empty, copy the non-empty one to result
+		strcpy(result, directory ? directory : file ? file : "");
+	} else {
+		// If both directory and file are not NULL or empty, concatenate them with a separator
+		sprintf(result, "%s%s%s", directory, directory[strlen(directory) - 1] == '/' ? "" : "/", file);
+	}
+}
+
+
+int check_command_or_filename(char *buf, char *filename_start) {
+	const char *splitters = " \t"; 
+	int len = strlen(buf);
+	int flag = 0;
+	while(len>0 && strchr(splitters,buf[0]) != NULL) {  
+		buf++;
+		len--;
+	}
+	while(len>0 && strchr(splitters,buf[len-1]) != NULL) {
+		buf[--len] = 0; 
+		flag = 1;
+	}
+	char *tokch = strtok(buf,splitters);
+	if(tokch == NULL) return 0;
+
+	if(flag) {
+		filename_start[0] = '\0';
+		return 1;
+	}
+	tokch = strtok(NULL,splitters);
+
+	if(tokch == NULL) { // check for command case
+		strcpy(filename_start, buf);
+		return 0;
+	};
+	char *last_token = tokch;
+	while((tokch=strtok(NULL,splitters)) != NULL){ // trim string until char
+		last_token=tokch;
+		if(last_token[strlen(last_token)-1] == '|') { // check for command case after pipe
+			tokch=strtok(NULL,splitters);
+			last_token=tokch;
+			strcpy(filename_start, last_token);
+			return 0;
+		}
+	} 
+	strcpy(filename_start, last_token);
+	return 1; // check for file case
+}
+
+// Function to order two command names for qsort
+int compare_index_names(const void *a, const void *b) {
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Function to split PATH into its directories
+int split_path(const char *path_value, char ***dirs) {
+	int count = 0;
+	char *path = strdup(path_value), *save = NULL;
+	*dirs = NULL;
+	for (char *dir = strtok_r(path, ":", &save); dir; dir = strtok_r(NULL, ":", &save)) {
+		*dirs = realloc(*dirs, sizeof(char *) * (count + 1));
+		(*dirs)[count++] = strdup(dir);
+	}
+	free(path);
+	return count;
+}
+
+void free_path_dirs(char **dirs, int count) {
+	for (int i = 0; i < count; i++) free(dirs[i]);
+	free(dirs);
+}
+
+// Function to take the mtime stamp of a directory
+void stamp_directory(const char *dir, struct index_stamp *stamp) {
+	struct stat st;
+	if (stat(dir, &st) == 0) {
+		stamp->sec = st.st_mtim.tv_sec;
+		stamp->nsec = st.st_mtim.tv_nsec;
+	} else {
+		stamp->sec = -1;
+		stamp->nsec = 0;
+	}
+}
+
+// Function to release a command index, whether heap built or mapped
+void free_command_index(struct command_index *index) {
+	if (index->map) munmap(index->map, index->map_len);
+	else free(index->arena);
+	free(index->names);
+	for (int i = 0; i < index->extra_count; i++) free(index->extra[i]);
+	free(index->extra);
+	memset(index, 0, sizeof(struct command_index));
+}
+
+// Function to get the per-user cache directory, creating it if needed
+const char *hshell_cache_dir(void) {
+	static char dir[4096];
+	if (dir[0]) return dir;
+	const char *base = getenv("XDG_CACHE_HOME");
+	if (base && *base) snprintf(dir, sizeof(dir), "%s/%s", base, sysname);
+	else if (getenv("HOME")) snprintf(dir, sizeof(dir), "%s/.cache/%s", getenv("HOME"), sysname);
+	else return NULL;
+	char *slash = dir;
+	while ((slash = strchr(slash + 1, '/')) != NULL) { // mkdir -p
+		*slash = '\0';
+		mkdir(dir, 0700);
+		*slash = '/';
+	}
+	mkdir(dir, 0700);
+	return dir;
+}
+
+// Function to scan PATH and the custom commands into a new index
+void scan_available_commands(struct command_index *index, char **dirs, int dir_count) {
+	size_t capacity = 65536, num = 0, offsets_capacity = 1024;
+	size_t *offsets = malloc(sizeof(size_t) * offsets_capacity);
+	memset(index, 0, sizeof(struct command_index));
+	index->arena = malloc(capacity);
+
+	int num_cmds = sizeof(builtin_command_list) / sizeof(builtin_command_list[0]);
+	for (int d = 0; d <= dir_count; d++) {
+		DIR *directory = d < dir_count ? opendir(dirs[d]) : NULL;
+		struct dirent *directory_entry;
+		for (int b = 0;; b++) {
+			const char *name;
+			if (directory) { // a PATH directory
+				if ((directory_entry = readdir(directory)) == NULL) break;
+				name = directory_entry->d_name;
+				if (name[0] == '.') continue;
+				if (faccessat(dirfd(directory), name, X_OK, 0) != 0) continue;
+			} else if (d == dir_count && b < num_cmds) { // add the built in commands
+				name = builtin_command_list[b];
+			} else {
+				break;
+			}
+			size_t len = strlen(name) + 1;
+			while (index->arena_len + len > capacity) index->arena = realloc(index->arena, capacity *= 2);
+			if (num == offsets_capacity) offsets = realloc(offsets, sizeof(size_t) * (offsets_capacity *= 2));
+			memcpy(index->arena + index->arena_len, name, len);
+			offsets[num++] = index->arena_len;
+			index->arena_len += len;
+		}
+		if (directory) closedir(directory);
+	}
+
+	// sort once, then duplicates are neighbours
+	index->names = malloc(sizeof(char *) * (num ? num : 1));
+	for (size_t i = 0; i < num; i++) index->names[i] = index->arena + offsets[i];
+	qsort(index->names, num, sizeof(char *), compare_index_names);
+	for (size_t i = 0; i < num; i++) {
+		if (index->count > 0 && strcmp(index->names[index->count - 1], index->names[i]) == 0) continue;
+		index->names[index->count++] = index->names[i];
+	}
+	index->capacity = num;
+	free(offsets);
+}
+
+// Function to write an index to the cache file, atomically replacing the old one
+void write_command_index(const struct command_index *index, const char *path_value,
+						 const struct index_stamp *stamps, int dir_count) {
+	const char *dir = hshell_cache_dir();
+	if (!dir) return;
+	char file_name[4200], tmp_name[4300];
+	snprintf(file_name, sizeof(file_name), "%s/commands.idx", dir);
+	snprintf(tmp_name, sizeof(tmp_name), "%s.%d", file_name, (int)getpid());
+	FILE *file = fopen(tmp_name, "w");
+	if (!file) return;
+
+	struct index_header header = {INDEX_MAGIC, dir_count, index->count, strlen(path_value), 0};
+	uint32_t *offsets = malloc(sizeof(uint32_t) * (index->count ? index->count : 1));
+	for (int i = 0; i < index->count; i++) { // names in sorted order, arena rewritten compactly
+		offsets[i] = header.arena_len;
+		header.arena_len += strlen(index->names[i]) + 1;
+	}
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(stamps, sizeof(struct index_stamp), dir_count, file);
+	fwrite(path_value, 1, header.path_len, file);
+	fwrite(offsets, sizeof(uint32_t), index->count, file);
+	for (int i = 0; i < index->count; i++) fwrite(index->names[i], 1, strlen(index->names[i]) + 1, file);
+	free(offsets);
+	if (fclose(file) != 0 || rename(tmp_name, file_name) != 0) remove(tmp_name);
+}
+
+// Function to map the cache file into an index; fresh tells whether PATH and
+// every directory mtime still match what the file was built from
+bool load_command_index(struct command_index *index, const char *path_value,
+						char **dirs, int dir_count, bool *fresh) {
+	const char *dir = hshell_cache_dir();
+	if (!dir) return false;
+	char file_name[4200];
+	snprintf(file_name, sizeof(file_name), "%s/commands.idx", dir);
+	int fd = open(file_name, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return false;
+	struct stat st;
+	void *map = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(struct index_header))
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) return false;
+
+	const struct index_header *header = map;
+	size_t len = st.st_size;
+	size_t stamps_at = sizeof(struct index_header);
+	size_t path_at = stamps_at + (size_t)header->dir_count * sizeof(struct index_stamp);
+	size_t offsets_at = path_at + header->path_len;
+	size_t arena_at = offsets_at + (size_t)header->name_count * sizeof(uint32_t);
+	if (memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) != 0 || arena_at > len ||
+		arena_at + header->arena_len != len || (header->arena_len && ((char *)map)[len - 1] != '\0')) {
+		munmap(map, len);
+		return false;
+	}
+
+	*fresh = header->dir_count == (uint32_t)dir_count && header->path_len == strlen(path_value) &&
+			 memcmp((char *)map + path_at, path_value, header->path_len) == 0;
+	const struct index_stamp *stamps = (const struct index_stamp *)((char *)map + stamps_at);
+	for (int i = 0; *fresh && i < dir_count; i++) {
+		struct index_stamp now;
+		stamp_directory(dirs[i], &now);
+		*fresh = now.sec == stamps[i].sec && now.nsec == stamps[i].nsec;
+	}
+
+	// offsets are unaligned when the PATH length is odd, so read them with memcpy
+	memset(index, 0, sizeof(struct command_index));
+	index->map = map;
+	index->map_len = len;
+	index->arena = (char *)map + arena_at;
+	index->arena_len = header->arena_len;
+	index->count = index->capacity = header->name_count;
+	index->names = malloc(sizeof(char *) * (index->count ? index->count : 1));
+	for (int i = 0; i < index->count; i++) {
+		uint32_t offset;
+		memcpy(&offset, (char *)map + offsets_at + (size_t)i * sizeof(uint32_t), sizeof(offset));
+		if (offset >= header->arena_len) {
+			free_command_index(index);
+			return false;
+		}
+		index->names[i] = index->arena + offset;
+	}
+	return true;
+}
+
+// Thread body rebuilding the index and its cache file
+void *index_builder_thread(void *arg) {
+	struct index_builder *builder = arg;
+	char **dirs;
+	int dir_count = split_path(builder->path_value, &dirs);
+	struct index_stamp *stamps = malloc(sizeof(struct index_stamp) * (dir_count ? dir_count : 1));
+	for (int i = 0; i < dir_count; i++) stamp_directory(dirs[i], &stamps[i]); // stamp before scanning
+	scan_available_commands(&builder->result, dirs, dir_count);
+	write_command_index(&builder->result, builder->path_value, stamps, dir_count);
+	free(stamps);
+	free_path_dirs(dirs, dir_count);
+	__atomic_store_n(&builder->done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+// Function to start rebuilding the index in the background
+void start_index_rebuild(void) {
+	if (index_builder.running) {
+		index_changed_during_build = true;
+		return;
+	}
+	free(index_builder.path_value);
+	index_builder.path_value = strdup(getenv("PATH") ? getenv("PATH") : "");
+	index_builder.done = 0;
+	index_changed_during_build = false;
+	if (pthread_create(&index_builder.thread, NULL, index_builder_thread, &index_builder) == 0) {
+		index_builder.running = true;
+	} else { // no thread available, build in place
+		index_builder_thread(&index_builder);
+		free_command_index(&cmd_index);
+		cmd_index = index_builder.result;
+	}
+}
+
+// Function to watch the PATH directories for added or removed executables
+void watch_path_directories(char **dirs, int dir_count) {
+	index_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (index_inotify_fd < 0) return;
+	for (int i = 0; i < dir_count; i++) {
+		int wd = inotify_add_watch(index_inotify_fd, dirs[i], INDEX_EVENTS | IN_DELETE_SELF | IN_MOVE_SELF);
+		if (wd < 0) continue;
+		if (wd >= index_watch_count) {
+			index_watch_dirs = realloc(index_watch_dirs, sizeof(char *) * (wd + 1));
+			for (int j = index_watch_count; j <= wd; j++) index_watch_dirs[j] = NULL;
+			index_watch_count = wd + 1;
+		}
+		free(index_watch_dirs[wd]);
+		index_watch_dirs[wd] = strdup(dirs[i]);
+	}
+}
+
+// Function to find where a name is or would be in the sorted index
+int index_position(const char *name, bool *found) {
+	int lo = 0, hi = cmd_index.count;
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (strcmp(cmd_index.names[mid], name) < 0) lo = mid + 1;
+		else hi = mid;
+	}
+	*found = lo < cmd_index.count && strcmp(cmd_index.names[lo], name) == 0;
+	return lo;
+}
+
+// Function to apply one inotify event on name in the PATH directory dir
+// (NULL if unknown) to the index without a rescan
+void index_apply_event(const char *dir, const char *name) {
+	if (name[0] == '.') return;
+	bool executable = false, found;
+	int num_cmds = sizeof(builtin_command_list) / sizeof(builtin_command_list[0]);
+	for (int i = 0; i < num_cmds && !executable; i++) executable = strcmp(builtin_command_list[i], name) == 0;
+	char full_path[4096];
+	if (!executable && dir) { // an added command is found where the event came from
+		snprintf(full_path, sizeof(full_path), "%s/%s", dir, name);
+		executable = access(full_path, X_OK) == 0;
+	}
+	if (!executable) { // the name may still exist in another directory
+		char **dirs;
+		int dir_count = split_path(getenv("PATH") ? getenv("PATH") : "", &dirs);
+		for (int i = 0; i < dir_count && !executable; i++) {
+			snprintf(full_path, sizeof(full_path), "%s/%s", dirs[i], name);
+			executable = access(full_path, X_OK) == 0;
+		}
+		free_path_dirs(dirs, dir_count);
+	}
+
+	int at = index_position(name, &found);
+	if (executable && !found) {
+		if (cmd_index.count == cmd_index.capacity) {
+			cmd_index.capacity = cmd_index.capacity ? cmd_index.capacity * 2 : 64;
+			cmd_index.names = realloc(cmd_index.names, sizeof(char *) * cmd_index.capacity);
+		}
+		cmd_index.extra = realloc(cmd_index.extra, sizeof(char *) * (cmd_index.extra_count + 1));
+		cmd_index.extra[cmd_index.extra_count] = strdup(name);
+		memmove(&cmd_index.names[at + 1], &cmd_index.names[at], sizeof(char *) * (cmd_index.count - at));
+		cmd_index.names[at] = cmd_index.extra[cmd_index.extra_count++];
+		cmd_index.count++;
+	} else if (!executable && found) {
+		memmove(&cmd_index.names[at], &cmd_index.names[at + 1], sizeof(char *) * (cmd_index.count - at - 1));
+		cmd_index.count--;
+	}
+}
+
+// Function to switch to the index the builder thread made, waiting for it
+void adopt_built_index(void) {
+	pthread_join(index_builder.thread, NULL);
+	index_builder.running = false;
+	free_command_index(&cmd_index);
+	cmd_index = index_builder.result;
+	memset(&index_builder.result, 0, sizeof(struct command_index));
+	if (index_changed_during_build) start_index_rebuild(); // the scan may have missed them
+}
+
+// Function to pick up a finished background build and pending inotify events
+void command_index_poll(void) {
+	if (index_builder.running && __atomic_load_n(&index_builder.done, __ATOMIC_ACQUIRE)) adopt_built_index();
+	if (index_inotify_fd < 0) return;
+
+	char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+	while ((len = read(index_inotify_fd, events, sizeof(events))) > 0) {
+		for (char *at = events; at < events + len;) {
+			struct inotify_event *event = (struct inotify_event *)at;
+			at += sizeof(struct inotify_event) + event->len;
+			if (event->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF)) start_index_rebuild();
+			else if (index_builder.running) index_changed_during_build = true;
+			else if (event->len > 0)
+				index_apply_event(event->wd < index_watch_count ? index_watch_dirs[event->wd] : NULL, event->name);
+		}
+	}
+}
+
+// Function to load the command index of all commands under PATH together with
+// custom commands. A valid cache file is used directly; otherwise it is rebuilt
+// in the background while a stale copy (if any) serves completion meanwhile.
+void save_available_commands(void) {
+	cmd_index_loaded = true;
+	const char *path_value = getenv("PATH") ? getenv("PATH") : "";
+	char **dirs;
+	int dir_count = split_path(path_value, &dirs);
+	bool fresh = false;
+	if (!load_command_index(&cmd_index, path_value, dirs, dir_count, &fresh) || !fresh)
+		start_index_rebuild();
+	watch_path_directories(dirs, dir_count);
+	free_path_dirs(dirs, dir_count);
+}
+
+
+// Builtin "compgen": print the completions of a prefix, commands with -c
+// (default) and files with -f, the same way Tab would find them
+int compgen_builtin(struct command_t *command) {
+	int i = 1;
+	bool files = false;
+	if (command->arg_count > 2 && (strcmp(command->args[1], "-c") == 0 || strcmp(command->args[1], "-f") == 0)) {
+		files = command->args[1][1] == 'f';
+		i++;
+	}
+	const char *prefix = i < command->arg_count - 1 ? command->args[i] : "";
+	struct autocomplete_struct *match;
+	if (files) {
+		match = directory_complete(prefix);
+	} else {
+		if (!cmd_index_loaded) save_available_commands();
+		while (index_builder.running) adopt_built_index(); // no prompt to wait behind
+		match = command_complete(prefix);
+	}
+	for (int j = 0; j < match->count; j++) printf("%s\n", match->matches[j]);
+	last_status = match->count ? 0 : 1;
+	free_autocomplete_struct(match);
+	free(match);
+	return SUCCESS;
+}
+
+// Function to autocomplete commands based on input string
+// Matches are a range of the sorted command index, nothing is copied
+struct autocomplete_struct *command_complete(const char *input_str) {
+	command_index_poll();
+	struct autocomplete_struct *match = calloc(1, sizeof(struct autocomplete_struct)); // Allocate memory for match struct
+	size_t len = strlen(input_str);
+	bool found;
+	int first = index_position(input_str, &found); // first name not below the prefix
+	int lo = first, hi = cmd_index.count;
+	while (lo < hi) { // first name past the prefix range
+		int mid = lo + (hi - lo) / 2;
+		if (strncmp(cmd_index.names[mid], input_str, len) <= 0) lo = mid + 1;
+		else hi = mid;
+	}
+	match->matches = cmd_index.names + first;
+	match->count = lo - first;
+	match->borrowed = true;
+	match->stem_len = len;
+	return match;
+}
+
+
+// Function to read a directory into a sorted snapshot with getdents64,
+// classifying entries by d_type so no stat is needed per entry
+void read_dir_snapshot(int fd, struct dir_snapshot *snapshot) {
+	size_t capacity = 4096, used = 0, num = 0, offsets_capacity = 256;
+	size_t *offsets = malloc(sizeof(size_t) * offsets_capacity);
+	char *arena = malloc(capacity);
+	char entries[65536] __attribute__((aligned(8)));
+	ssize_t len;
+	while ((len = getdents64(fd, entries, sizeof(entries))) > 0) {
+		for (ssize_t at = 0; at < len;) {
+			struct dirent64 *entry = (struct dirent64 *)(entries + at);
+			at += entry->d_reclen;
+			if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+			bool is_dir = entry->d_type == DT_DIR;
+			if (entry->d_type == DT_UNKNOWN) { // file system without d_type
+				struct stat st;
+				is_dir = fstatat(fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+			}
+			size_t name_len = strlen(entry->d_name);
+			while (used + name_len + 2 > capacity) arena = realloc(arena, capacity *= 2);
+			if (num == offsets_capacity) offsets = realloc(offsets, sizeof(size_t) * (offsets_capacity *= 2));
+			offsets[num++] = used;
+			memcpy(arena + used, entry->d_name, name_len);
+			used += name_len;
+			if (is_dir) arena[used++] = '/';
+			arena[used++] = '\0';
+		}
+	}
+
+	free(snapshot->arena);
+	free(snapshot->names);
+	snapshot->arena = arena;
+	snapshot->names = malloc(sizeof(char *) * (num ? num : 1));
+	for (size_t i = 0; i < num; i++) snapshot->names[i] = arena + offsets[i];
+	qsort(snapshot->names, num, sizeof(char *), compare_index_names);
+	snapshot->count = num;
+	free(offsets);
+}
+
+// Function to get the snapshot of a directory, rescanning only when it changed
+struct dir_snapshot *get_dir_snapshot(const char *dir_name) {
+	int fd = open(dir_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) return NULL;
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return NULL;
+	}
+
+	struct dir_snapshot *snapshot = &dir_snapshots[0];
+	for (int i = 0; i < DIR_SNAPSHOTS; i++) {
+		struct dir_snapshot *candidate = &dir_snapshots[i];
+		if (candidate->names && candidate->dev == st.st_dev && candidate->ino == st.st_ino) {
+			snapshot = candidate;
+			break;
+		}
+		if (candidate->last_used < snapshot->last_used) snapshot = candidate; // least recently used
+	}
+	if (!snapshot->names || snapshot->dev != st.st_dev || snapshot->ino != st.st_ino ||
+		snapshot->mtime.tv_sec != st.st_mtim.tv_sec || snapshot->mtime.tv_nsec != st.st_mtim.tv_nsec) {
+		read_dir_snapshot(fd, snapshot);
+		snapshot->dev = st.st_dev;
+		snapshot->ino = st.st_ino;
+		snapshot->mtime = st.st_mtim;
+	}
+	close(fd);
+	snapshot->last_used = ++dir_snapshot_clock;
+	return snapshot;
+}
+
+// Function to autocomplete file and directory names based on input string,
+// which may include a path such as "src/sh"
+struct autocomplete_struct *directory_complete(const char *input_str) {
+	struct autocomplete_struct *match = calloc(1, sizeof(struct autocomplete_struct)); // Allocate memory for match struct
+	const char *slash = strrchr(input_str, '/');
+	const char *prefix = slash ? slash + 1 : input_str;
+	char dir_name[4096];
+	if (!slash) strcpy(dir_name, ".");
+	else if (slash == input_str) strcpy(dir_name, "/");
+	else snprintf(dir_name, sizeof(dir_name), "%.*s", (int)(slash - input_str), input_str);
+
+	match->borrowed = true;
+	match->stem_len = strlen(prefix);
+	struct dir_snapshot *snapshot = get_dir_snapshot(dir_name);
+	if (!snapshot) return match;
+
+	int lo = 0, hi = snapshot->count;
+	while (lo < hi) { // first entry not below the prefix
+		int mid = lo + (hi - lo) / 2;
+		if (strcmp(snapshot->names[mid], prefix) < 0) lo = mid + 1;
+		else hi = mid;
+	}
+	int first = lo;
+	hi = snapshot->count;
+	while (lo < hi) { // first entry past the prefix range
+		int mid = lo + (hi - lo) / 2;
+		if (strncmp(snapshot->names[mid], prefix, match->stem_len) <= 0) lo = mid + 1;
+		else hi = mid;
+	}
+	match->matches = snapshot->names + first;
+	match->count = lo - first;
+	return match;
+}
+
+
+void regressionAndPlot(struct command_t *command){
+    char* filename;
+    int regressionType=1;
+    int degree;
+    
+    //Read from command:
+    if(command->arg_count==3){
+   	 filename=command->args[1];
+    }
+    else if(command->arg_count==5){
+   	 filename=command->args[1];
+   	 degree=atoi(command->args[3]);
+   	 if (strcmp(command->args[2], "-p")==0){
+   		 regressionType=2;
+   	 }
+    }
+    else{
+   	 printf("Number of arguments are not correct\n");
+   	 return;
+    }
+    
+    FILE *fp;
+    double *x = malloc(sizeof(double) * 128), *y = malloc(sizeof(double) * 128);
+    int n = 0, capacity = 128; // Number of data points
+    fp = fopen(filename, "r");
+    if (fp == NULL){
+   	 printf("Error opening file!\n");
+    }
+    // Read data points from file
+    printf("Data Points:\n");
+    printf("x\t y\n");
+    while (fscanf(fp, "%lf %lf", &x[n], &y[n]) == 2){
    	 printf("%.2f\t%.2f\n", x[n], y[n]);
    	 n++;
+   	 if (n == capacity){ // grow for large data sets
+   		 capacity *= 2;
+   		 x = realloc(x, sizeof(double) * capacity);
+   		 y = realloc(y, sizeof(double) * capacity);
+   	 }
+    }
+    fclose(fp);
+    if (n == 0){
+    	printf("Expected data not found!\n");
+    }
+    
+    double coefficients[100],slope, intercept;
+	// Perform regression and obtain coefficients.
+    
+	if(regressionType == 1){ //linear regression
+    	double sum_x = 0, sum_y = 0, sum_xy = 0, sum_xx = 0;
+   	 // Calculate required sums
+   	 for(int i=0; i<n; i++){
+   		 sum_y += y[i];
+   	 	sum_x += x[i];
+   	 	sum_xy += x[i] * y[i];
+   	 	sum_xx += x[i] * x[i];
+   	 }
+   	 slope = (n*sum_xy - sum_x*sum_y)/(n*sum_xx - sum_x*sum_x);
+   	 intercept = (sum_y-(slope)*sum_x)/n;
+   	 printf("\nLinear Regression Coefficients:\n");
+    	printf("Coefficient a0: %.2f\n", intercept);
+   	 printf("Coefficient a1: %.2f\n", slope);
+	}
+    
+	else if (regressionType == 2) { //polynomial regression
+    	// Constructing needed X matrix and Y vector.
+   	 double X[degree+1][degree+1];
+   	 for(int i=0; i<=degree; i++){
+   	 	for(int j=0; j<=degree; j++){
+   	     	X[i][j] = 0;
+   	     	for(int k=0; k<n; k++) {
+   	         	X[i][j] += pow(x[k], i+j);
+   	     	}
+   	 	}
+   	 }
+
+   	 double Y[degree + 1];
+   	 for(int i=0; i<=degree; i++){
+   	 	Y[i]=0;
+   	 	for(int k=0; k<n; k++){
+   	     	Y[i]+=pow(x[k], i)*y[k];
+   	 	}
+   	 }
+   	 
+   	 // Solve equations
+   	 for(int i=0; i<=degree; i++){
+   	 	for(int j=i+1; j<=degree; j++){
+   	     	double ratio=X[j][i]/X[i][i];
+   	     	for(int k=0; k<=degree; k++){
+   	         	X[j][k] -= ratio*X[i][k];
+   	     	}
+   	     	Y[j] -= ratio*Y[i];
+   	 	}
+   	 }
+   	 for(int i=degree; i>=0; i--){
+   	 	coefficients[i] = Y[i];
+   	 	for(int j=i+1; j<=degree; j++){
+   	     	coefficients[i] -= X[i][j]*coefficients[j];
+   	 	}
+   	 	coefficients[i]/=X[i][i];
+   	 }
+   	 
+    	printf("\nPolynomial Regression Coefficients:\n");
+    	for(int i = 0; i <= degree; i++){
+   	 printf("Coefficient a%d: %.2lf\n", i, coefficients[i]);
+   	 }
+	}else{
+    	printf("Invalid regression type!\n");
+	}
+    
+	FILE *datafile = fopen("data.txt", "w");
+	if(fp != NULL){
+    	for (int i = 0; i < n; i++){
+        	fprintf(datafile, "%lf %lf\n", x[i], y[i]);
+    	}
+    	fclose(datafile);
+	}else{
+    	fprintf(stderr, "Error: Unable to open file %s for writing\n", filename);
+	}   
+    
+	//Using gnuplot to plot
+    
+	FILE *gp = popen("gnuplot", "w");
+	if (gp != NULL) {
+    	fprintf(gp, "set terminal pngcairo enhanced font \"arial,10\" size 800,600\n"); //for appearence
+    	fprintf(gp, "set output \"plot.png\"\n");
+    	fprintf(gp, "set title \"Regression Plot\"\n");
+    	fprintf(gp, "set xlabel \"X\"\n");
+    	fprintf(gp, "set ylabel \"Y\"\n");
+    	fprintf(gp, "plot \"data.txt\" with points title \"Data Points\", ");
+    	if (regressionType == 1){
+        	fprintf(gp, "%f*x + %f with lines title \"Linear Regression\"\n", slope, intercept);
+    	}else{
+        	fprintf(gp, "%f", coefficients[0]);
+        	for (int i = 1; i <= degree; i++){
+            	fprintf(gp, " + %f*x**%d", coefficients[i], i);
+        	}
+        	fprintf(gp, " with lines title \"Polynomial Regression\"\n");
+    	}
+    	fprintf(gp, "quit\n");
+    	pclose(gp);
+	}else{
+    	fprintf(stderr, "Error: Unable to open Gnuplot\n");
+	}
+	free(x);
+	free(y);
+}
+
+// Function to read until the buffer is full or the input ends
+ssize_t read_full(int fd, uint8_t *buffer, size_t size) {
+	size_t done = 0;
+	while (done < size) {
+		ssize_t n = read(fd, buffer + done, size - done);
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) return -1;
+		if (n == 0) break;
+		done += n;
+	}
+	return done;
+}
+
+// Counts textify takes in one pass. Letters are ASCII letters and digits,
+// words are runs of non-space bytes as fscanf("%s") splits them.
+struct text_counts {
+	uint64_t letters, words, lines, bytes;
+	bool in_word; // the last byte seen was part of a word
+};
+
+// Function to count a block a byte at a time
+void text_count_scalar(struct text_counts *counts, const uint8_t *p, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		uint8_t c = p[i];
+		bool space = c == ' ' || (c >= '\t' && c <= '\r');
+		counts->letters += (uint8_t)((c | 0x20) - 'a') < 26 || (uint8_t)(c - '0') < 10;
+		counts->lines += c == '\n';
+		counts->words += !space && !counts->in_word;
+		counts->in_word = !space;
+	}
+	counts->bytes += n;
+}
+
+#if defined(__x86_64__)
+// Function to count a block 32 bytes at a time. Each class is a byte mask;
+// a word starts at a non-space byte whose previous byte is a space.
+__attribute__((target("avx2,popcnt")))
+void text_count_avx2(struct text_counts *counts, const uint8_t *p, size_t n) {
+	// unsigned x - low < width, as a signed compare after moving low to -128
+#define TEXT_IN_RANGE(x, low, width) _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(-128 + (width))), \
+						_mm256_add_epi8((x), _mm256_set1_epi8((char)(128 - (low)))))
+	uint32_t before = !counts->in_word; // bit 0: the byte before the block is a space
+	size_t i = 0;
+	for (; i + 32 <= n; i += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(p + i));
+		__m256i letters = _mm256_or_si256(TEXT_IN_RANGE(_mm256_or_si256(x, _mm256_set1_epi8(0x20)), 'a', 26),
+										  TEXT_IN_RANGE(x, '0', 10));
+		__m256i spaces = _mm256_or_si256(TEXT_IN_RANGE(x, '\t', 5), _mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')));
+		uint32_t space = _mm256_movemask_epi8(spaces);
+		counts->letters += __builtin_popcount(_mm256_movemask_epi8(letters));
+		counts->lines += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n'))));
+		counts->words += __builtin_popcount(~space & ((space << 1) | before));
+		before = space >> 31;
+	}
+#undef TEXT_IN_RANGE
+	counts->in_word = !before;
+	counts->bytes += i;
+	text_count_scalar(counts, p + i, n - i);
+}
+#endif
+
+// Function to count a block with the best routine this CPU has
+void text_count_block(struct text_counts *counts, const uint8_t *p, size_t n) {
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) { // cached by libgcc at startup
+		text_count_avx2(counts, p, n);
+		return;
+	}
+#endif
+	text_count_scalar(counts, p, n);
+}
+
+// Function to pass a whole file to scan in one pass. Regular files are
+// mapped, anything else is read in 1 MiB blocks.
+bool text_scan_file(int fd, void (*scan)(void *arg, const uint8_t *p, size_t n), void *arg) {
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			scan(arg, map, st.st_size);
+			munmap(map, st.st_size);
+			return true;
+		}
+	}
+	const size_t block = 1 << 20;
+	uint8_t *buffer = malloc(block);
+	ssize_t n;
+	while ((n = read_full(fd, buffer, block)) > 0) scan(arg, buffer, n);
+	free(buffer);
+	return n == 0;
+}
+
+void text_count_scan(void *counts, const uint8_t *p, size_t n) {
+	text_count_block(counts, p, n);
+}
+
+// A mapped file cut at whitespace into chunks for the textify workers, so
+// no word is split between two of them
+#define TEXT_CHUNK_MIN (8 << 20)
+
+struct text_chunks {
+	const uint8_t *data;
+	size_t *starts; // chunk i is [starts[i], starts[i + 1])
+	size_t count;
+	size_t next; // next chunk to take, atomic
+	void (*scan_chunk)(void *state, const uint8_t *data, size_t start, size_t end);
+};
+
+struct text_worker {
+	struct text_chunks *chunks;
+	void *state;
+};
+
+void *text_chunk_worker(void *arg) {
+	struct text_worker *worker = arg;
+	struct text_chunks *chunks = worker->chunks;
+	size_t i;
+	while ((i = __atomic_fetch_add(&chunks->next, 1, __ATOMIC_RELAXED)) < chunks->count)
+		chunks->scan_chunk(worker->state, chunks->data, chunks->starts[i], chunks->starts[i + 1]);
+	return NULL;
+}
+
+// Function to get the number of textify workers, one per core unless asked
+int text_threads(int requested) {
+	int threads = requested > 0 ? requested : sysconf(_SC_NPROCESSORS_ONLN);
+	return threads < 1 ? 1 : threads;
+}
+
+// Function to scan a file in chunks on up to threads workers, worker w
+// passing its own states[w] to scan_chunk. Returns how many workers ran,
+// or 0 when the file is not a regular file worth splitting and has to be
+// scanned in one stream instead.
+int text_scan_parallel(int fd, int threads, void (*scan_chunk)(void *state, const uint8_t *data, size_t start, size_t end),
+					   void **states) {
+	struct stat st;
+	if (threads < 2 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < 2 * TEXT_CHUNK_MIN) return 0;
+	size_t size = st.st_size;
+	void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) return 0;
+
+	// a few chunks per worker evens out their speeds; each chunk but the
+	// first starts at a whitespace byte
+	struct text_chunks chunks = {.data = map, .scan_chunk = scan_chunk};
+	size_t chunk = size / ((size_t)threads * 4);
+	if (chunk < TEXT_CHUNK_MIN) chunk = TEXT_CHUNK_MIN;
+	chunks.starts = malloc(sizeof(size_t) * (size / chunk + 2));
+	chunks.starts[chunks.count++] = 0;
+	for (size_t at = chunk; at < size; at += chunk) {
+		size_t start = at;
+		if (start <= chunks.starts[chunks.count - 1]) continue; // the last chunk ran past it
+		while (start < size && !(chunks.data[start] == ' ' || (chunks.data[start] >= '\t' && chunks.data[start] <= '\r')))
+			start++;
+		if (start < size) chunks.starts[chunks.count++] = start;
+		else break;
+	}
+	chunks.starts[chunks.count] = size;
+
+	if ((size_t)threads > chunks.count) threads = chunks.count;
+	struct text_worker workers[threads];
+	pthread_t pool[threads];
+	int started = 1;
+	for (int w = 0; w < threads; w++) workers[w] = (struct text_worker){&chunks, states[w]};
+	for (; started < threads; started++)
+		if (pthread_create(&pool[started], NULL, text_chunk_worker, &workers[started]) != 0) break;
+	text_chunk_worker(&workers[0]); // this thread works too
+	for (int w = 1; w < started; w++) pthread_join(pool[w], NULL);
+	free(chunks.starts);
+	munmap(map, size);
+	return started;
+}
+
+// Function to count a chunk; chunks start at whitespace, outside any word
+void text_count_chunk(void *counts, const uint8_t *data, size_t start, size_t end) {
+	((struct text_counts *)counts)->in_word = false;
+	text_count_block(counts, data + start, end - start);
+}
+
+// Function to count a file, in chunks on threads workers when it is big
+bool text_count_file(int fd, int threads, struct text_counts *counts) {
+	memset(counts, 0, sizeof(struct text_counts));
+	threads = text_threads(threads);
+	struct text_counts *parts = calloc(threads, sizeof(struct text_counts));
+	void **states = malloc(sizeof(void *) * threads);
+	for (int w = 0; w < threads; w++) states[w] = &parts[w];
+	int workers = text_scan_parallel(fd, threads, text_count_chunk, states);
+	for (int w = 0; w < workers; w++) { // sums, so the order of the chunks does not matter
+		counts->letters += parts[w].letters;
+		counts->words += parts[w].words;
+		counts->lines += parts[w].lines;
+		counts->bytes += parts[w].bytes;
+	}
+	free(parts);
+	free(states);
+	return workers > 0 || text_scan_file(fd, text_count_scan, counts);
+}
+
+// Aho-Corasick automaton for textify -count_patterns. Bytes that occur in
+// no pattern share class 0, so the transition table is states x classes
+// rather than states x 256 and stays small enough to live in cache.
+struct pattern_automaton {
+	uint8_t classes[256];
+	uint32_t class_count;
+	uint32_t *next; // next[state * class_count + class], failures already folded in
+	uint32_t *depth;
+	uint32_t *out_link; // nearest proper suffix state that ends a pattern, 0 for none
+	bool *terminal; // a pattern ends here
+	bool *reports; // terminal or has an out_link
+	uint64_t *hits;
+	uint32_t count, capacity;
+	uint32_t longest; // deepest state, the longest pattern
+	bool substrings; // count matches anywhere, not only whole words
+	uint32_t state; // scan state, carried from one block to the next
+	uint64_t token_len;
+};
+
+// Function to build the automaton; nodes[i] is the state pattern i ends in
+void automaton_build(struct pattern_automaton *a, char **patterns, int count, uint32_t *nodes) {
+	bool used[256] = {false};
+	for (int i = 0; i < count; i++)
+		for (const uint8_t *p = (const uint8_t *)patterns[i]; *p; p++) used[*p] = true;
+	a->class_count = 1;
+	for (int b = 0; b < 256; b++) a->classes[b] = used[b] ? a->class_count++ : 0;
+	uint32_t classes = a->class_count;
+
+	// the trie; state 0 is the root, which is never a child
+	a->count = 1;
+	a->capacity = 64;
+	a->next = calloc((size_t)a->capacity * classes, sizeof(uint32_t));
+	a->depth = calloc(a->capacity, sizeof(uint32_t));
+	a->terminal = calloc(a->capacity, sizeof(bool));
+	for (int i = 0; i < count; i++) {
+		uint32_t s = 0;
+		for (const uint8_t *p = (const uint8_t *)patterns[i]; *p; p++) {
+			uint32_t *slot = &a->next[(size_t)s * classes + a->classes[*p]];
+			if (*slot == 0) {
+				if (a->count == a->capacity) {
+					a->capacity *= 2;
+					a->next = realloc(a->next, sizeof(uint32_t) * a->capacity * classes);
+					memset(a->next + (size_t)a->count * classes, 0, sizeof(uint32_t) * (a->capacity - a->count) * classes);
+					a->depth = realloc(a->depth, sizeof(uint32_t) * a->capacity);
+					a->terminal = realloc(a->terminal, sizeof(bool) * a->capacity);
+					memset(a->terminal + a->count, 0, a->capacity - a->count);
+					slot = &a->next[(size_t)s * classes + a->classes[*p]];
+				}
+				a->depth[a->count] = a->depth[s] + 1;
+				if (a->depth[a->count] > a->longest) a->longest = a->depth[a->count];
+				*slot = a->count++;
+			}
+			s = *slot;
+		}
+		a->terminal[s] = s != 0;
+		nodes[i] = s;
+	}
+
+	// breadth first, so a state's failure is complete before the state:
+	// a missing transition becomes the failure state's transition
+	uint32_t *fail = calloc(a->count, sizeof(uint32_t)), *queue = malloc(sizeof(uint32_t) * a->count);
+	a->out_link = calloc(a->count, sizeof(uint32_t));
+	a->reports = calloc(a->count, sizeof(bool));
+	a->hits = calloc(a->count, sizeof(uint64_t));
+	uint32_t head = 0, tail = 0;
+	for (uint32_t c = 1; c < classes; c++) if (a->next[c]) queue[tail++] = a->next[c];
+	while (head < tail) {
+		uint32_t s = queue[head++];
+		uint32_t *row = &a->next[(size_t)s * classes], *fail_row = &a->next[(size_t)fail[s] * classes];
+		for (uint32_t c = 1; c < classes; c++) {
+			if (row[c] == 0) {
+				row[c] = fail_row[c];
+				continue;
+			}
+			uint32_t u = row[c], f = fail_row[c];
+			fail[u] = f;
+			a->out_link[u] = a->terminal[f] ? f : a->out_link[f];
+			queue[tail++] = u;
+		}
+	}
+	for (uint32_t s = 0; s < a->count; s++) a->reports[s] = a->terminal[s] || a->out_link[s];
+	free(fail);
+	free(queue);
+}
+
+// Function to run a block through the automaton. Substring matches are
+// counted at every byte; a whole word matches when a space or the end of
+// the input follows a token the automaton read in full.
+void automaton_scan(void *arg, const uint8_t *p, size_t n) {
+	struct pattern_automaton *a = arg;
+	const uint32_t *next = a->next, classes = a->class_count;
+	uint32_t s = a->state;
+	if (a->substrings) {
+		for (size_t i = 0; i < n; i++) {
+			s = next[(size_t)s * classes + a->classes[p[i]]];
+			if (!a->reports[s]) continue;
+			for (uint32_t v = a->terminal[s] ? s : a->out_link[s]; v; v = a->out_link[v]) a->hits[v]++;
+		}
+	} else {
+		uint64_t token_len = a->token_len;
+		for (size_t i = 0; i < n; i++) {
+			uint8_t c = p[i];
+			if (c == ' ' || (c >= '\t' && c <= '\r')) {
+				if (a->terminal[s] && a->depth[s] == token_len) a->hits[s]++;
+				s = 0;
+				token_len = 0;
+			} else {
+				s = next[(size_t)s * classes + a->classes[c]];
+				token_len++;
+			}
+		}
+		a->token_len = token_len;
+	}
+	a->state = s;
+}
+
+// Function to count the last word of the input
+void automaton_finish(struct pattern_automaton *a) {
+	if (!a->substrings && a->terminal[a->state] && a->depth[a->state] == a->token_len) a->hits[a->state]++;
+}
+
+// Function to count a chunk. A substring match can begin before the
+// chunk, so the longest pattern's worth of bytes before it is replayed
+// first; whole words cannot, as chunks start at whitespace.
+void automaton_chunk(void *arg, const uint8_t *data, size_t start, size_t end) {
+	struct pattern_automaton *a = arg;
+	a->state = 0;
+	a->token_len = 0;
+	if (a->substrings) {
+		size_t from = a->longest > 0 && start > a->longest - 1 ? start - (a->longest - 1) : 0;
+		for (size_t i = from; i < start; i++) a->state = a->next[(size_t)a->state * a->class_count + a->classes[data[i]]];
+	}
+	automaton_scan(a, data + start, end - start);
+	automaton_finish(a);
+}
+
+void automaton_free(struct pattern_automaton *a) {
+	free(a->next);
+	free(a->depth);
+	free(a->out_link);
+	free(a->terminal);
+	free(a->reports);
+	free(a->hits);
+}
+
+// Function to count every pattern in a file in one pass; counts[i] is for
+// pattern i, and duplicate patterns get the same count. Workers share the
+// tables and keep their own hits, summed at the end.
+bool count_patterns(int fd, int threads, char **patterns, int count, bool substrings, uint64_t *counts) {
+	struct pattern_automaton a = {.substrings = substrings};
+	uint32_t *nodes = malloc(sizeof(uint32_t) * (count + 1));
+	automaton_build(&a, patterns, count, nodes);
+	threads = text_threads(threads);
+	struct pattern_automaton *copies = malloc(sizeof(struct pattern_automaton) * threads);
+	void **states = malloc(sizeof(void *) * threads);
+	for (int w = 0; w < threads; w++) {
+		copies[w] = a;
+		copies[w].hits = w == 0 ? a.hits : calloc(a.count, sizeof(uint64_t));
+		states[w] = &copies[w];
+	}
+	int workers = text_scan_parallel(fd, threads, automaton_chunk, states);
+	for (int w = 1; w < threads; w++) {
+		if (w < workers) for (uint32_t s = 0; s < a.count; s++) a.hits[s] += copies[w].hits[s];
+		free(copies[w].hits);
+	}
+	free(copies);
+	free(states);
+	bool ok = workers > 0;
+	if (!ok) {
+		ok = text_scan_file(fd, automaton_scan, &a);
+		automaton_finish(&a);
+	}
+	for (int i = 0; i < count; i++) counts[i] = nodes[i] ? a.hits[nodes[i]] : 0;
+	automaton_free(&a);
+	free(nodes);
+	return ok;
+}
+
+// Whole word replacement for textify -change_words. Unchanged spans of the
+// input and the replacements are queued as iovecs and written together, so
+// the input is copied through in large writes with its whitespace intact.
+#define REWRITE_IOVECS 1024
+
+struct word_rewriter {
+	struct pattern_automaton a;
+	const char **replacements; // by automaton state
+	size_t longest; // longest old word, the most a streamed block has to hold back
+	int fd;
+	struct iovec iov[REWRITE_IOVECS];
+	int iov_count;
+	uint64_t replaced;
+	bool failed; // a write failed, errno tells why
+};
+
+// Function to write all queued iovecs, following short writes
+void rewrite_flush(struct word_rewriter *rw) {
+	struct iovec *iov = rw->iov;
+	int count = rw->iov_count;
+	rw->iov_count = 0;
+	while (count > 0 && !rw->failed) {
+		ssize_t n = writev(rw->fd, iov, count);
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) {
+			rw->failed = true;
+			return;
+		}
+		while (count > 0 && (size_t)n >= iov->iov_len) n -= iov->iov_len, iov++, count--;
+		if (count > 0) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+}
+
+void rewrite_queue(struct word_rewriter *rw, const void *p, size_t n) {
+	if (n == 0) return;
+	if (rw->iov_count == REWRITE_IOVECS) rewrite_flush(rw);
+	rw->iov[rw->iov_count].iov_base = (void *)p;
+	rw->iov[rw->iov_count++].iov_len = n;
+}
+
+// Function to rewrite p[0, n). The first pending bytes were scanned by the
+// previous call and held back as the start of an unfinished word; unless
+// final, the bytes of a word still open at the end are held back in turn
+// and their count returned. Queued spans point into p, so they are written
+// before returning.
+size_t rewrite_block(struct word_rewriter *rw, const uint8_t *p, size_t n, size_t pending, bool final) {
+	struct pattern_automaton *a = &rw->a;
+	const uint32_t *next = a->next, classes = a->class_count;
+	uint32_t s = a->state;
+	uint64_t token_len = a->token_len;
+	size_t emitted = 0;
+	for (size_t i = pending; i <= n; i++) {
+		bool end = i == n;
+		if (!end && !(p[i] == ' ' || (p[i] >= '\t' && p[i] <= '\r'))) {
+			s = next[(size_t)s * classes + a->classes[p[i]]];
+			token_len++;
+			continue;
+		}
+		if (end && !final) break;
+		if (a->terminal[s] && a->depth[s] == token_len) { // the word just ended is an old word
+			rewrite_queue(rw, p + emitted, i - token_len - emitted);
+			rewrite_queue(rw, rw->replacements[s], strlen(rw->replacements[s]));
+			emitted = i;
+			rw->replaced++;
+		}
+		s = 0;
+		token_len = 0;
+	}
+	a->state = s;
+	a->token_len = token_len;
+	size_t hold = final || token_len > rw->longest ? 0 : token_len; // a longer word cannot match
+	rewrite_queue(rw, p + emitted, n - hold - emitted);
+	rewrite_flush(rw);
+	return hold;
+}
+
+// Function to copy a file to fd with every old word replaced by its new
+// word, in one pass. Regular files are mapped, anything else is streamed.
+bool rewrite_words(int in, int out, char **old_words, char **new_words, int count, uint64_t *replaced) {
+	struct word_rewriter rw = {.fd = out};
+	uint32_t *nodes = malloc(sizeof(uint32_t) * (count + 1));
+	automaton_build(&rw.a, old_words, count, nodes);
+	rw.replacements = calloc(rw.a.count, sizeof(char *));
+	for (int i = 0; i < count; i++) { // a later pair for the same word wins
+		rw.replacements[nodes[i]] = new_words[i];
+		if (strlen(old_words[i]) > rw.longest) rw.longest = strlen(old_words[i]);
+	}
+	bool ok = true;
+	struct stat st;
+	void *map = MAP_FAILED;
+	if (fstat(in, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, in, 0);
+	if (map != MAP_FAILED) {
+		madvise(map, st.st_size, MADV_SEQUENTIAL);
+		rewrite_block(&rw, map, st.st_size, 0, true);
+		munmap(map, st.st_size);
+	} else {
+		const size_t block = 1 << 20;
+		uint8_t *buffer = malloc(block + rw.longest);
+		size_t held = 0;
+		ssize_t n;
+		while ((n = read_full(in, buffer + held, block)) > 0 && !rw.failed) {
+			size_t hold = rewrite_block(&rw, buffer, held + n, held, false);
+			memmove(buffer, buffer + held + n - hold, hold);
+			held = hold;
+		}
+		ok = n == 0;
+		if (ok) rewrite_block(&rw, buffer, held, held, true);
+		free(buffer);
+	}
+	*replaced = rw.replaced;
+	automaton_free(&rw.a);
+	free(rw.replacements);
+	free(nodes);
+	return ok && !rw.failed;
+}
+
+void textify(struct command_t *command) {
+    //-j <n> anywhere sets the workers for the counting modes, one per core by default
+    int threads=0;
+    for (int i=1; i+1<command->arg_count-1; i++) {
+        if (strcmp(command->args[i], "-j")!=0) continue;
+        threads=atoi(command->args[i+1]);
+        memmove(&command->args[i], &command->args[i+2], sizeof(char *) * (command->arg_count-i-2));
+        command->arg_count-=2;
+        i--;
     }
-    fclose(fp);
-    if (n == 0){
-    	printf("Expected data not found!\n");
+    if (command->arg_count<4) { //arg_count includes the NULL ending args
+        printf("You should enter: <filename> <mode(-count_letters, \
+        -count_words, -count_all, -count_specific_word, -count_patterns, -change_words)> [additional arguments]\n");
+        return;
     }
+    const char *filename=command->args[1];
     
-    double coefficients[100],slope, intercept;
-	// Perform regression and obtain coefficients.
+    //open file:
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        fprintf(stderr, "Error: Failed to open file\n");
+        return;
+    }
     
-	if(regressionType == 1){ //linear regression
-    	double sum_x = 0, sum_y = 0, sum_xy = 0, sum_xx = 0;
-   	 // Calculate required sums
-   	 for(int i=0; i<n; i++){
-   		 sum_y += y[i];
-   	 	sum_x += x[i];
-   	 	sum_xy += x[i] * y[i];
-   	 	sum_xx += x[i] * x[i];
-   	 }
-   	 slope = (n*sum_xy - sum_x*sum_y)/(n*sum_xx - sum_x*sum_x);
-   	 intercept = (sum_y-(slope)*sum_x)/n;
-   	 printf("\nLinear Regression Coefficients:\n");
-    	printf("Coefficient a0: %.2f\n", intercept);
-   	 printf("Coefficient a1: %.2f\n", slope);
+    //do what is needed according to mode
+    const char *mode=command->args[2];
+    
+    if (strcmp(mode, "-count_letters")==0 || strcmp(mode, "-count_words")==0 || strcmp(mode, "-count_all")==0) {
+        struct text_counts counts;
+        bool ok=text_count_file(fileno(file), threads, &counts); //one pass gives all of them
+        fclose(file);
+        if (!ok) {
+            fprintf(stderr, "Error: Failed to read file: %s\n", strerror(errno));
+            return;
+        }
+        if (strcmp(mode, "-count_letters")==0) printf("Number of letters in %s: %" PRIu64 "\n", filename, counts.letters);
+        else if (strcmp(mode, "-count_words")==0) printf("Number of words in %s: %" PRIu64 "\n", filename, counts.words);
+        else printf("%s: %" PRIu64 " letters, %" PRIu64 " words, %" PRIu64 " lines, %" PRIu64 " bytes\n",
+                    filename, counts.letters, counts.words, counts.lines, counts.bytes);
+    } 
+    
+    else if (strcmp(mode, "-count_specific_word") == 0) {
+        if (command->arg_count < 5) {
+            printf("Do not forget to enter the word to look for as the third argument!\n");
+            return;
+        }
+        
+        const char *searched_word = command->args[3];
+        uint64_t count=0;
+        bool ok=count_patterns(fileno(file), threads, &command->args[3], 1, false, &count);
+        fclose(file);
+        if (!ok) {
+            fprintf(stderr, "Error: Failed to read file: %s\n", strerror(errno));
+            return;
+        }
+        printf("Number of occurrences of '%s' in %s: %" PRIu64 "\n", searched_word, filename, count);
+    } 
+    
+    else if (strcmp(mode, "-count_patterns") == 0) {
+        //patterns come from the arguments and from -f files, one per line
+        bool substrings=false;
+        int pattern_count=0, pattern_capacity=64;
+        char **patterns=malloc(sizeof(char *) * pattern_capacity);
+        bool ok=true;
+        for (int i=3; i<command->arg_count-1 && ok; i++) {
+            const char *arg=command->args[i];
+            FILE *list=NULL;
+            if (strcmp(arg, "-substring")==0) {
+                substrings=true;
+                continue;
+            } else if (strcmp(arg, "-words")==0) {
+                substrings=false;
+                continue;
+            } else if (strcmp(arg, "-f")==0 && i+1<command->arg_count-1) {
+                if ((list=fopen(command->args[++i], "r"))==NULL) {
+                    fprintf(stderr, "Error: Failed to open pattern file %s\n", command->args[i]);
+                    ok=false;
+                    break;
+                }
+            }
+            char *line=NULL;
+            size_t line_capacity=0;
+            ssize_t len;
+            const char *pattern=arg; //a word, or each line of the list
+            while (!list || (len=getline(&line, &line_capacity, list)) != -1) {
+                if (list) {
+                    while (len>0 && (line[len-1]=='\n' || line[len-1]=='\r')) line[--len]='\0';
+                    if (len==0) continue;
+                    pattern=line;
+                }
+                if (pattern_count==pattern_capacity) patterns=realloc(patterns, sizeof(char *) * (pattern_capacity*=2));
+                patterns[pattern_count++]=strdup(pattern);
+                if (!list) break;
+            }
+            free(line);
+            if (list) fclose(list);
+        }
+        if (ok && pattern_count==0) {
+            printf("Give the patterns to count as arguments or with -f <file>\n");
+            ok=false;
+        }
+        uint64_t *counts=malloc(sizeof(uint64_t) * (pattern_count+1));
+        if (ok && !count_patterns(fileno(file), threads, patterns, pattern_count, substrings, counts)) {
+            fprintf(stderr, "Error: Failed to read file: %s\n", strerror(errno));
+            ok=false;
+        }
+        fclose(file);
+        if (ok) {
+            uint64_t total=0;
+            printf("Occurrences in %s (%s):\n", filename, substrings ? "substrings" : "whole words");
+            for (int i=0; i<pattern_count; i++) {
+                printf("%12" PRIu64 "  %s\n", counts[i], patterns[i]);
+                total+=counts[i];
+            }
+            printf("%12" PRIu64 "  in total\n", total);
+        }
+        for (int i=0; i<pattern_count; i++) free(patterns[i]);
+        free(patterns);
+        free(counts);
+    } 
+    
+    else if (strcmp(mode, "-change_words") == 0) {
+        if (command->arg_count < 6) {
+            printf("Do not forget to write the word that will be changed as the 3th, word to change to 4th argument\n");
+            fclose(file);
+            return;
+        }
+        
+        //the replacement table: old and new word pairs, and -f files with a pair per line
+        int pair_count=0, pair_capacity=16;
+        char **old_words=malloc(sizeof(char *) * pair_capacity), **new_words=malloc(sizeof(char *) * pair_capacity);
+        bool ok=true;
+        for (int i=3; i<command->arg_count-1 && ok; i++) {
+            FILE *table=NULL;
+            if (strcmp(command->args[i], "-f")==0 && i+1<command->arg_count-1) {
+                if ((table=fopen(command->args[++i], "r"))==NULL) {
+                    fprintf(stderr, "Error: Failed to open replacement file %s\n", command->args[i]);
+                    ok=false;
+                    break;
+                }
+            } else if (i+1>=command->arg_count-1) {
+                printf("The word '%s' has no word to change to\n", command->args[i]);
+                ok=false;
+                break;
+            }
+            char *line=NULL;
+            size_t line_capacity=0;
+            while (!table || getline(&line, &line_capacity, table) != -1) {
+                char *old_word, *new_word;
+                if (table) { //old word, then the new word or nothing to delete it
+                    old_word=strtok(line, " \t\r\n");
+                    new_word=strtok(NULL, " \t\r\n");
+                    if (!old_word) continue;
+                } else {
+                    old_word=command->args[i];
+                    new_word=command->args[++i];
+                }
+                if (pair_count==pair_capacity) {
+                    pair_capacity*=2;
+                    old_words=realloc(old_words, sizeof(char *) * pair_capacity);
+                    new_words=realloc(new_words, sizeof(char *) * pair_capacity);
+                }
+                old_words[pair_count]=strdup(old_word);
+                new_words[pair_count++]=strdup(new_word ? new_word : "");
+                if (!table) break;
+            }
+            free(line);
+            if (table) fclose(table);
+        }
+        if (ok && pair_count==0) {
+            printf("The replacement file has no words to change\n");
+            ok=false;
+        }
+        
+        //To name the second file properly.
+        const char *dot_position = strrchr(filename, '.');
+        if (!dot_position) {
+            fprintf(stderr, "Error: Invalid filename\n");
+            ok=false;
+            dot_position = filename;
+        }
+        size_t filename_length = dot_position - filename;
+        char updated_filename[filename_length + strlen("-updated") + strlen(".txt") + 1];
+        strncpy(updated_filename, filename, filename_length); // Copy the filename without extension
+        updated_filename[filename_length] = '\0'; // Null-terminate the string
+        strcat(updated_filename, "-updated.txt"); // Append "-updated.txt"
+
+        //Opening new file:
+        int updated_fd = ok ? open(updated_filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666) : -1;
+        if (ok && updated_fd == -1) {
+            fprintf(stderr, "Error: Failed to create updated file\n");
+            ok=false;
+        }
+
+        //one pass: unchanged spans are copied through as they are, whitespace included
+        uint64_t replaced=0;
+        if (ok && !rewrite_words(fileno(file), updated_fd, old_words, new_words, pair_count, &replaced)) {
+            fprintf(stderr, "Error: Failed to write %s: %s\n", updated_filename, strerror(errno));
+            ok=false;
+        }
+        if (updated_fd != -1 && close(updated_fd) != 0 && ok) {
+            fprintf(stderr, "Error: Failed to write %s: %s\n", updated_filename, strerror(errno));
+            ok=false;
+        }
+        fclose(file);
+        if (ok && pair_count == 1)
+            printf("%" PRIu64 " occurrences of '%s' in %s changed to '%s' in %s\n", replaced, old_words[0], filename, new_words[0], updated_filename);
+        else if (ok)
+            printf("%" PRIu64 " words in %s changed by %d replacements in %s\n", replaced, filename, pair_count, updated_filename);
+        for (int i=0; i<pair_count; i++) {
+            free(old_words[i]);
+            free(new_words[i]);
+        }
+        free(old_words);
+        free(new_words);
+        return;
+    } 
+    else {
+        fprintf(stderr, "That mode does not exist!\n");
+        return;
+    }
+}
+
+// State of a byte comparison for hdiff -b. Blocks are compared with AVX2
+// when the CPU has it and eight bytes at a time otherwise; offsets are 64 bit.
+struct byte_compare {
+	bool ranges; // print the differing byte ranges
+	bool bits; // count differing bits rather than bytes
+	uint64_t bytes, bit_count;
+	bool in_range; // a differing range is open
+	uint64_t range_start;
+};
+
+// Function to print a finished range of differing bytes
+void byte_range_end(struct byte_compare *compare, uint64_t end) {
+	printf("%" PRIu64 "-%" PRIu64 " (%" PRIu64 " bytes)\n", compare->range_start, end - 1, end - compare->range_start);
+	compare->in_range = false;
+}
+
+// Function to follow the differing ranges through a mask with one bit per
+// byte (set when the bytes differ) covering width bytes at offset
+void byte_ranges_mask(struct byte_compare *compare, uint64_t diff, int width, uint64_t offset) {
+	uint64_t valid = width == 64 ? ~0ULL : (1ULL << width) - 1;
+	int at = 0;
+	while (at < width) {
+		uint64_t rest = (diff >> at) & (valid >> at);
+		if (compare->in_range) {
+			uint64_t equal = ~rest & (valid >> at);
+			if (equal == 0) return; // still differing at the end of the mask
+			at += __builtin_ctzll(equal);
+			byte_range_end(compare, offset + at);
+		} else {
+			if (rest == 0) return;
+			at += __builtin_ctzll(rest);
+			compare->range_start = offset + at;
+			compare->in_range = true;
+		}
+	}
+}
+
+// Function to compare a block eight bytes at a time
+void byte_compare_scalar(struct byte_compare *compare, const uint8_t *a, const uint8_t *b, size_t n, uint64_t offset) {
+	const uint64_t high = 0x8080808080808080ULL, low = 0x7f7f7f7f7f7f7f7fULL;
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		uint64_t x, y;
+		memcpy(&x, a + i, 8);
+		memcpy(&y, b + i, 8);
+		x ^= y;
+		if (x == 0 && !compare->in_range) continue;
+		uint64_t nonzero = (((x & low) + low) | x) & high; // top bit of each differing byte
+		compare->bytes += __builtin_popcountll(nonzero);
+		if (compare->bits) compare->bit_count += __builtin_popcountll(x);
+		if (compare->ranges) {
+			uint64_t mask = 0;
+			for (int j = 0; j < 8; j++) mask |= ((nonzero >> (8 * j + 7)) & 1) << j; // little endian
+			byte_ranges_mask(compare, mask, 8, offset + i);
+		}
+	}
+	for (; i < n; i++) {
+		uint8_t x = a[i] ^ b[i];
+		compare->bytes += x != 0;
+		if (compare->bits) compare->bit_count += __builtin_popcount(x);
+		if (compare->ranges) byte_ranges_mask(compare, x != 0, 1, offset + i);
+	}
+}
+
+#if defined(__x86_64__)
+// Function to compare a block 32 bytes at a time
+__attribute__((target("avx2,popcnt")))
+void byte_compare_avx2(struct byte_compare *compare, const uint8_t *a, const uint8_t *b, size_t n, uint64_t offset) {
+	const __m256i nibbles = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+											 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i low_nibble = _mm256_set1_epi8(0x0f);
+	__m256i bit_sums = _mm256_setzero_si256();
+	size_t i = 0;
+	for (; i + 32 <= n; i += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+		__m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+		uint32_t diff = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+		if (diff == 0 && !compare->in_range) continue;
+		compare->bytes += __builtin_popcount(diff);
+		if (compare->bits) { // popcount of the xor through a nibble table
+			__m256i v = _mm256_xor_si256(x, y);
+			__m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(nibbles, _mm256_and_si256(v, low_nibble)),
+											 _mm256_shuffle_epi8(nibbles, _mm256_and_si256(_mm256_srli_epi16(v, 4), low_nibble)));
+			bit_sums = _mm256_add_epi64(bit_sums, _mm256_sad_epu8(counts, _mm256_setzero_si256()));
+		}
+		if (compare->ranges) byte_ranges_mask(compare, diff, 32, offset + i);
+	}
+	uint64_t sums[4];
+	_mm256_storeu_si256((__m256i *)sums, bit_sums);
+	compare->bit_count += sums[0] + sums[1] + sums[2] + sums[3];
+	byte_compare_scalar(compare, a + i, b + i, n - i, offset + i);
+}
+#endif
+
+// Function to compare two blocks with the best routine this CPU has
+void byte_compare_block(struct byte_compare *compare, const uint8_t *a, const uint8_t *b, size_t n, uint64_t offset) {
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) { // cached by libgcc at startup
+		byte_compare_avx2(compare, a, b, n, offset);
+		return;
+	}
+#endif
+	byte_compare_scalar(compare, a, b, n, offset);
+}
+
+// XXH64 of a byte string
+uint64_t xxh64(const void *input, size_t len, uint64_t seed) {
+	const uint64_t p1 = 11400714785074694791ULL, p2 = 14029467366897019727ULL, p3 = 1609587929392839161ULL;
+	const uint64_t p4 = 9650029242287828579ULL, p5 = 2870177450012600261ULL;
+	const uint8_t *p = input, *end = p + len;
+	uint64_t h, lane;
+#define XXH_ROTL(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+#define XXH_ROUND(acc, v) ((acc) = XXH_ROTL((acc) + (v) * p2, 31) * p1)
+	if (len >= 32) {
+		uint64_t v1 = seed + p1 + p2, v2 = seed + p2, v3 = seed, v4 = seed - p1;
+		for (; p + 32 <= end; p += 32) {
+			memcpy(&lane, p, 8); XXH_ROUND(v1, lane);
+			memcpy(&lane, p + 8, 8); XXH_ROUND(v2, lane);
+			memcpy(&lane, p + 16, 8); XXH_ROUND(v3, lane);
+			memcpy(&lane, p + 24, 8); XXH_ROUND(v4, lane);
+		}
+		h = XXH_ROTL(v1, 1) + XXH_ROTL(v2, 7) + XXH_ROTL(v3, 12) + XXH_ROTL(v4, 18);
+		uint64_t vs[4] = {v1, v2, v3, v4};
+		for (int i = 0; i < 4; i++) {
+			uint64_t v = 0;
+			XXH_ROUND(v, vs[i]);
+			h = (h ^ v) * p1 + p4;
+		}
+	} else {
+		h = seed + p5;
+	}
+	h += len;
+	for (; p + 8 <= end; p += 8) {
+		uint64_t k = 0;
+		memcpy(&lane, p, 8);
+		XXH_ROUND(k, lane);
+		h = XXH_ROTL(h ^ k, 27) * p1 + p4;
+	}
+	if (p + 4 <= end) {
+		uint32_t word;
+		memcpy(&word, p, 4);
+		h = XXH_ROTL(h ^ (word * p1), 23) * p2 + p3;
+		p += 4;
+	}
+	for (; p < end; p++) h = XXH_ROTL(h ^ (*p * p5), 11) * p1;
+#undef XXH_ROUND
+#undef XXH_ROTL
+	h ^= h >> 33;
+	h *= p2;
+	h ^= h >> 29;
+	h *= p3;
+	h ^= h >> 32;
+	return h;
+}
+
+// What identifies an unchanged file; a stored fingerprint is only used
+// while all of it still matches
+struct fingerprint_key {
+	uint64_t dev, ino, size;
+	int64_t mtime_sec, mtime_nsec;
+};
+
+// Content fingerprint of a file: the XXH64 of every FINGERPRINT_BLOCK
+// bytes, and of the whole file as the hash of those block hashes
+#define FINGERPRINT_BLOCK 65536
+#define FINGERPRINT_MAGIC "HFPRINT1"
+
+struct block_fingerprint {
+	struct fingerprint_key key;
+	uint64_t hash;
+	uint64_t *blocks;
+	size_t count;
+};
+
+// Layout of a fingerprint file: the header, then count block hashes
+struct fingerprint_header {
+	char magic[8];
+	struct fingerprint_key key;
+	uint64_t block_size, hash, count;
+};
+
+bool fingerprint_store_enabled = true; // cleared by hdiff -nocache
+unsigned long fingerprints_saved; // by this hdiff run, atomic
+
+// Bounds of the store, kept by removing the least recently used fingerprints
+#define FINGERPRINT_STORE_FILES 4096
+#define FINGERPRINT_STORE_BYTES (256 << 20)
+
+struct fingerprint_key fingerprint_key_of(const struct stat *st) {
+	return (struct fingerprint_key){st->st_dev, st->st_ino, st->st_size, st->st_mtim.tv_sec, st->st_mtim.tv_nsec};
+}
+
+// Function to name the store file of a file, one per device and inode
+bool fingerprint_file_name(char *name, size_t size, const struct fingerprint_key *key) {
+	const char *dir = hshell_cache_dir();
+	if (!dir) return false;
+	snprintf(name, size, "%s/fingerprints/%" PRIx64 "-%" PRIx64, dir, key->dev, key->ino);
+	return true;
+}
+
+// Function to load a file's fingerprint from the store, false when there
+// is none or the file changed since it was taken
+bool fingerprint_load(struct block_fingerprint *fp, const struct fingerprint_key *key) {
+	memset(fp, 0, sizeof(struct block_fingerprint));
+	char name[4300];
+	if (!fingerprint_store_enabled || !fingerprint_file_name(name, sizeof(name), key)) return false;
+	int fd = open(name, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) return false;
+	struct fingerprint_header header;
+	uint64_t count = (key->size + FINGERPRINT_BLOCK - 1) / FINGERPRINT_BLOCK;
+	bool ok = read_full(fd, (uint8_t *)&header, sizeof(header)) == sizeof(header) &&
+			  memcmp(header.magic, FINGERPRINT_MAGIC, sizeof(header.magic)) == 0 &&
+			  memcmp(&header.key, key, sizeof(struct fingerprint_key)) == 0 &&
+			  header.block_size == FINGERPRINT_BLOCK && header.count == count;
+	if (ok) {
+		fp->blocks = malloc(sizeof(uint64_t) * (count + 1));
+		ok = read_full(fd, (uint8_t *)fp->blocks, sizeof(uint64_t) * count) == (ssize_t)(sizeof(uint64_t) * count);
+	}
+	if (ok) futimens(fd, NULL); // last use, what the store is pruned by
+	close(fd);
+	if (!ok) { // stale: the file changed or the inode now belongs to another
+		unlink(name);
+		free(fp->blocks);
+		fp->blocks = NULL;
+		return false;
+	}
+	fp->key = *key;
+	fp->hash = header.hash;
+	fp->count = count;
+	return true;
+}
+
+// Function to save a fingerprint to the store. Files of one block are
+// cheaper to read again than to look up, and a file modified in the last
+// two seconds could change again within the same mtime, so neither is kept.
+bool fingerprint_worth_saving(const struct fingerprint_key *key) {
+	return fingerprint_store_enabled && key->size > FINGERPRINT_BLOCK && key->mtime_sec < (int64_t)time(NULL) - 2;
+}
+
+void fingerprint_save(const struct block_fingerprint *fp) {
+	char name[4300], tmp_name[4400];
+	if (!fingerprint_worth_saving(&fp->key) || !fingerprint_file_name(name, sizeof(name), &fp->key)) return;
+	snprintf(tmp_name, sizeof(tmp_name), "%s.%d.%lx", name, (int)getpid(), (unsigned long)pthread_self());
+	FILE *file = fopen(tmp_name, "w");
+	if (!file && errno == ENOENT) { // first fingerprint, make the directory
+		snprintf(tmp_name, sizeof(tmp_name), "%s/fingerprints", hshell_cache_dir());
+		mkdir(tmp_name, 0700);
+		snprintf(tmp_name, sizeof(tmp_name), "%s.%d.%lx", name, (int)getpid(), (unsigned long)pthread_self());
+		file = fopen(tmp_name, "w");
+	}
+	if (!file) return;
+	struct fingerprint_header header = {FINGERPRINT_MAGIC, fp->key, FINGERPRINT_BLOCK, fp->hash, fp->count};
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(fp->blocks, sizeof(uint64_t), fp->count, file);
+	if (fclose(file) != 0 || rename(tmp_name, name) != 0) remove(tmp_name);
+	else __atomic_fetch_add(&fingerprints_saved, 1, __ATOMIC_RELAXED);
+}
+
+struct fingerprint_entry {
+	char name[96];
+	time_t used;
+	off_t size;
+};
+
+int compare_fingerprint_use(const void *a, const void *b) {
+	time_t x = ((const struct fingerprint_entry *)a)->used, y = ((const struct fingerprint_entry *)b)->used;
+	return x < y ? -1 : x > y;
+}
+
+// Function to keep the store within its bounds. When it is over either
+// one, the least recently used fingerprints go until it is under three
+// quarters of both, so pruning does not come back after every save.
+// Temporary files left by interrupted saves are removed as well.
+void fingerprint_prune(void) {
+	char dir_name[4200];
+	const char *dir = hshell_cache_dir();
+	if (!dir) return;
+	snprintf(dir_name, sizeof(dir_name), "%s/fingerprints", dir);
+	DIR *directory = opendir(dir_name);
+	if (!directory) return;
+	size_t count = 0, capacity = 256;
+	uint64_t total = 0;
+	struct fingerprint_entry *entries = malloc(sizeof(struct fingerprint_entry) * capacity);
+	struct dirent *entry;
+	while ((entry = readdir(directory)) != NULL) {
+		struct stat st;
+		if (entry->d_name[0] == '.' || strlen(entry->d_name) >= sizeof(entries[0].name)) continue;
+		if (fstatat(dirfd(directory), entry->d_name, &st, 0) == -1 || !S_ISREG(st.st_mode)) continue;
+		if (strchr(entry->d_name, '.')) { // a save's temporary file
+			if (st.st_mtime < time(NULL) - 60) unlinkat(dirfd(directory), entry->d_name, 0);
+			continue;
+		}
+		if (count == capacity) entries = realloc(entries, sizeof(struct fingerprint_entry) * (capacity *= 2));
+		strcpy(entries[count].name, entry->d_name);
+		entries[count].used = st.st_mtime;
+		entries[count++].size = st.st_size;
+		total += st.st_size;
+	}
+	if (count > FINGERPRINT_STORE_FILES || total > FINGERPRINT_STORE_BYTES) {
+		qsort(entries, count, sizeof(struct fingerprint_entry), compare_fingerprint_use);
+		for (size_t i = 0; i < count && (count - i > FINGERPRINT_STORE_FILES / 4 * 3 || total > FINGERPRINT_STORE_BYTES / 4 * 3); i++) {
+			unlinkat(dirfd(directory), entries[i].name, 0);
+			total -= entries[i].size;
+		}
+	}
+	closedir(directory);
+	free(entries);
+}
+
+// Function to start a fingerprint whose blocks are hashed as they are read
+void fingerprint_begin(struct block_fingerprint *fp, const struct fingerprint_key *key) {
+	fp->key = *key;
+	fp->count = (key->size + FINGERPRINT_BLOCK - 1) / FINGERPRINT_BLOCK;
+	fp->blocks = malloc(sizeof(uint64_t) * (fp->count + 1));
+	fp->hash = 0;
+}
+
+// Function to hash block k of a file whose content starts at data
+void fingerprint_block(struct block_fingerprint *fp, size_t k, const uint8_t *data) {
+	uint64_t offset = (uint64_t)k * FINGERPRINT_BLOCK;
+	uint64_t len = fp->key.size - offset < FINGERPRINT_BLOCK ? fp->key.size - offset : FINGERPRINT_BLOCK;
+	fp->blocks[k] = xxh64(data + offset, len, 0);
+}
+
+void fingerprint_finish(struct block_fingerprint *fp) {
+	fp->hash = xxh64(fp->blocks, sizeof(uint64_t) * fp->count, fp->key.size);
+}
+
+// Function to fingerprint a file held whole in memory
+void fingerprint_data(struct block_fingerprint *fp, const struct fingerprint_key *key, const uint8_t *data) {
+	fingerprint_begin(fp, key);
+	for (size_t k = 0; k < fp->count; k++) fingerprint_block(fp, k, data);
+	fingerprint_finish(fp);
+}
+
+// hdiff -b: compare two files byte by byte. Regular files are mapped,
+// anything else is streamed in 1 MiB blocks. Bytes past the end of the
+// shorter file count as different. With stored fingerprints for both
+// files equal hashes mean identical, and only blocks whose hashes differ
+// are compared.
+void hdiff_bytes(const char *f_name1, const char *f_name2, struct byte_compare *compare) {
+	int fd1 = open(f_name1, O_RDONLY | O_CLOEXEC), fd2 = open(f_name2, O_RDONLY | O_CLOEXEC);
+	if (fd1 == -1 || fd2 == -1) {
+		printf("File not found!\n");
+		if (fd1 != -1) close(fd1);
+		if (fd2 != -1) close(fd2);
+		return;
+	}
+	struct stat st1, st2;
+	fstat(fd1, &st1);
+	fstat(fd2, &st2);
+	uint64_t len1 = 0, len2 = 0, common = 0;
+	void *map1 = MAP_FAILED, *map2 = MAP_FAILED;
+	bool regular = S_ISREG(st1.st_mode) && S_ISREG(st2.st_mode);
+	struct block_fingerprint fps[2];
+	struct fingerprint_key keys[2] = {fingerprint_key_of(&st1), fingerprint_key_of(&st2)};
+	bool known[2] = {false, false}, hashing[2] = {false, false};
+	for (int f = 0; f < 2 && regular; f++) {
+		known[f] = fingerprint_load(&fps[f], &keys[f]);
+		hashing[f] = !known[f] && fingerprint_worth_saving(&keys[f]);
+	}
+	bool same = known[0] && known[1] && fps[0].hash == fps[1].hash;
+	if (!same && regular && st1.st_size > 0 && st2.st_size > 0) {
+		map1 = mmap(NULL, st1.st_size, PROT_READ, MAP_PRIVATE, fd1, 0);
+		map2 = mmap(NULL, st2.st_size, PROT_READ, MAP_PRIVATE, fd2, 0);
+	}
+	if (same) { // identical without reading either
+		len1 = len2 = common = st1.st_size;
+	} else if (map1 != MAP_FAILED && map2 != MAP_FAILED) {
+		const uint8_t *data[2] = {map1, map2};
+		len1 = st1.st_size;
+		len2 = st2.st_size;
+		common = len1 < len2 ? len1 : len2;
+		madvise(map1, len1, MADV_SEQUENTIAL);
+		madvise(map2, len2, MADV_SEQUENTIAL);
+		for (int f = 0; f < 2; f++) if (hashing[f]) fingerprint_begin(&fps[f], &keys[f]);
+		bool by_block = (known[0] || hashing[0]) && (known[1] || hashing[1]);
+		const size_t window = 64 << 20; // lets finished pages go while comparing
+		for (uint64_t at = 0; at < common; at += window) {
+			size_t n = common - at < window ? common - at : window;
+			for (uint64_t offset = at; offset < at + n; offset += FINGERPRINT_BLOCK) {
+				size_t k = offset / FINGERPRINT_BLOCK;
+				size_t len = at + n - offset < FINGERPRINT_BLOCK ? at + n - offset : FINGERPRINT_BLOCK;
+				for (int f = 0; f < 2; f++) if (hashing[f]) fingerprint_block(&fps[f], k, data[f]);
+				if (by_block && len == FINGERPRINT_BLOCK && fps[0].blocks[k] == fps[1].blocks[k]) { // same block
+					if (compare->in_range) byte_range_end(compare, offset);
+					continue;
+				}
+				byte_compare_block(compare, data[0] + offset, data[1] + offset, len, offset);
+			}
+			madvise((uint8_t *)map1 + at, n, MADV_DONTNEED);
+			madvise((uint8_t *)map2 + at, n, MADV_DONTNEED);
+		}
+		for (int f = 0; f < 2; f++) {
+			if (!hashing[f]) continue;
+			for (size_t k = (common + FINGERPRINT_BLOCK - 1) / FINGERPRINT_BLOCK; k < fps[f].count; k++)
+				fingerprint_block(&fps[f], k, data[f]);
+			fingerprint_finish(&fps[f]);
+			fingerprint_save(&fps[f]);
+		}
+	} else {
+		const size_t block = 1 << 20;
+		uint8_t *buffer1 = malloc(block), *buffer2 = malloc(block);
+		while (1) {
+			ssize_t n1 = read_full(fd1, buffer1, block), n2 = read_full(fd2, buffer2, block);
+			if (n1 < 0 || n2 < 0) {
+				printf("Error reading the files: %s\n", strerror(errno));
+				break;
+			}
+			size_t n = n1 < n2 ? n1 : n2;
+			byte_compare_block(compare, buffer1, buffer2, n, common);
+			common += n;
+			len1 += n1;
+			len2 += n2;
+			if ((size_t)n1 < block || (size_t)n2 < block) { // one ended, count what is left of the other
+				ssize_t more;
+				while ((more = read_full(n1 < n2 ? fd2 : fd1, buffer1, block)) > 0) *(n1 < n2 ? &len2 : &len1) += more;
+				break;
+			}
+		}
+		free(buffer1);
+		free(buffer2);
+	}
+	for (int f = 0; f < 2; f++) if (known[f] || hashing[f]) free(fps[f].blocks);
+	if (map1 != MAP_FAILED) munmap(map1, st1.st_size);
+	if (map2 != MAP_FAILED) munmap(map2, st2.st_size);
+	close(fd1);
+	close(fd2);
+
+	if (compare->ranges) {
+		if (compare->in_range) byte_range_end(compare, common);
+		if (len1 != len2)
+			printf("%" PRIu64 "-%" PRIu64 " only in %s\n", common, (len1 > len2 ? len1 : len2) - 1,
+				   len1 > len2 ? f_name1 : f_name2);
+	}
+	uint64_t extra = (len1 > len2 ? len1 : len2) - common; //add the difference in length to difference also
+	if (compare->bits) {
+		uint64_t bits = compare->bit_count + 8 * extra;
+		if (bits == 0) printf("The two files are identical\n");
+		else printf("The two files are different in %" PRIu64 " bits\n", bits);
+	} else {
+		uint64_t bytes = compare->bytes + extra;
+		if (bytes == 0) printf("The two files are identical\n");
+		else printf("The two files are different in %" PRIu64 " bytes\n", bytes);
+	}
+}
+
+// A file split into lines for hdiff -a. Line i is data[starts[i], starts[i + 1])
+// and keeps its newline, so a missing final newline is a difference too.
+struct line_file {
+	const char *name;
+	const char *data;
+	size_t size;
+	bool mapped;
+	uint64_t *starts;
+	uint32_t *ids; // interned line numbers, equal lines have equal ids
+	size_t count;
+	bool *changed;
+};
+
+// Function to read a file whole, mapping it when it is a regular file
+bool line_file_load(struct line_file *file, const char *name) {
+	memset(file, 0, sizeof(struct line_file));
+	file->name = name;
+	int fd = open(name, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) return false;
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			file->data = map;
+			file->size = st.st_size;
+			file->mapped = true;
+		}
+	}
+	if (!file->mapped) { // pipes and the like
+		size_t capacity = 1 << 16;
+		char *data = malloc(capacity);
+		ssize_t n;
+		while ((n = read(fd, data + file->size, capacity - file->size)) != 0) {
+			if (n < 0 && errno == EINTR) continue;
+			if (n < 0) break;
+			file->size += n;
+			if (file->size == capacity) data = realloc(data, capacity *= 2);
+		}
+		file->data = data;
+	}
+	close(fd);
+
+	size_t capacity = 1024;
+	file->starts = malloc(sizeof(uint64_t) * capacity);
+	const char *p = file->data, *end = file->data + file->size;
+	while (p < end) {
+		if (file->count + 2 > capacity) file->starts = realloc(file->starts, sizeof(uint64_t) * (capacity *= 2));
+		file->starts[file->count++] = p - file->data;
+		const char *newline = memchr(p, '\n', end - p);
+		p = newline ? newline + 1 : end;
+	}
+	file->starts[file->count] = file->size;
+	file->ids = malloc(sizeof(uint32_t) * (file->count + 1));
+	file->changed = calloc(file->count + 1, sizeof(bool));
+	return true;
+}
+
+void line_file_free(struct line_file *file) {
+	if (file->mapped) munmap((void *)file->data, file->size);
+	else free((void *)file->data);
+	free(file->starts);
+	free(file->ids);
+	free(file->changed);
+}
+
+// Function to give every distinct line of both files a small id, so the
+// diff compares integers. Returns the number of distinct lines.
+uint32_t intern_lines(struct line_file *files) {
+	size_t total = files[0].count + files[1].count, capacity = 16;
+	while (capacity < total * 2) capacity *= 2;
+	uint32_t *slots = calloc(capacity, sizeof(uint32_t)); // id + 1 of the line hashed there, 0 when free
+	uint64_t *hashes = malloc(sizeof(uint64_t) * (total + 1)); // per id, with its first occurrence
+	const char **texts = malloc(sizeof(char *) * (total + 1));
+	uint32_t *lens = malloc(sizeof(uint32_t) * (total + 1));
+	uint32_t next_id = 0;
+	for (int f = 0; f < 2; f++) {
+		for (size_t i = 0; i < files[f].count; i++) {
+			const char *text = files[f].data + files[f].starts[i];
+			uint32_t len = files[f].starts[i + 1] - files[f].starts[i];
+			uint64_t hash = xxh64(text, len, 0);
+			size_t slot = hash & (capacity - 1);
+			uint32_t id;
+			while ((id = slots[slot]) != 0 && (hashes[id - 1] != hash || lens[id - 1] != len ||
+											   memcmp(texts[id - 1], text, len) != 0))
+				slot = (slot + 1) & (capacity - 1);
+			if (id == 0) {
+				hashes[next_id] = hash;
+				texts[next_id] = text;
+				lens[next_id] = len;
+				id = slots[slot] = ++next_id;
+			}
+			files[f].ids[i] = id - 1;
+		}
+	}
+	free(slots);
+	free(hashes);
+	free(texts);
+	free(lens);
+	return next_id;
+}
+
+// Linear space Myers diff over two id sequences. fd and bd hold the
+// furthest reaching x of each diagonal for the forward and backward
+// searches, indexed from -(m + 1).
+struct myers {
+	const uint32_t *a, *b;
+	bool *changed_a, *changed_b;
+	int32_t *fd, *bd;
+	int32_t too_expensive; // give up on a minimal split after this many rounds
+};
+
+// Function to find where a shortest edit script of a[xoff, xlim) and
+// b[yoff, ylim) crosses its middle, or a good guess when that is too costly
+void myers_split(struct myers *diff, int32_t xoff, int32_t xlim, int32_t yoff, int32_t ylim, int32_t *xmid, int32_t *ymid) {
+	int32_t *fd = diff->fd, *bd = diff->bd;
+	const uint32_t *a = diff->a, *b = diff->b;
+	const int32_t dmin = xoff - ylim, dmax = xlim - yoff;
+	const int32_t fmid = xoff - yoff, bmid = xlim - ylim;
+	int32_t fmin = fmid, fmax = fmid, bmin = bmid, bmax = bmid;
+	const bool odd = (fmid - bmid) & 1;
+	fd[fmid] = xoff;
+	bd[bmid] = xlim;
+	for (int32_t c = 1;; c++) {
+		if (fmin > dmin) fd[--fmin - 1] = -1;
+		else fmin++;
+		if (fmax < dmax) fd[++fmax + 1] = -1;
+		else fmax--;
+		for (int32_t d = fmax; d >= fmin; d -= 2) {
+			int32_t low = fd[d - 1], high = fd[d + 1];
+			int32_t x = low >= high ? low + 1 : high, y = x - d;
+			while (x < xlim && y < ylim && a[x] == b[y]) x++, y++;
+			fd[d] = x;
+			if (odd && bmin <= d && d <= bmax && bd[d] <= x) {
+				*xmid = x;
+				*ymid = y;
+				return;
+			}
+		}
+		if (bmin > dmin) bd[--bmin - 1] = INT32_MAX;
+		else bmin++;
+		if (bmax < dmax) bd[++bmax + 1] = INT32_MAX;
+		else bmax--;
+		for (int32_t d = bmax; d >= bmin; d -= 2) {
+			int32_t low = bd[d - 1], high = bd[d + 1];
+			int32_t x = low < high ? low : high - 1, y = x - d;
+			while (x > xoff && y > yoff && a[x - 1] == b[y - 1]) x--, y--;
+			bd[d] = x;
+			if (!odd && fmin <= d && d <= fmax && x <= fd[d]) {
+				*xmid = x;
+				*ymid = y;
+				return;
+			}
+		}
+		if (c < diff->too_expensive) continue;
+
+		// take whichever search got furthest along its diagonals
+		int64_t fbest = -1, bbest = INT64_MAX;
+		int32_t fx = xoff, bx = xlim;
+		for (int32_t d = fmax; d >= fmin; d -= 2) {
+			int32_t x = fd[d] < xlim ? fd[d] : xlim, y = x - d;
+			if (y > ylim) x = ylim + d, y = ylim;
+			if (fbest < (int64_t)x + y) fbest = (int64_t)x + y, fx = x;
+		}
+		for (int32_t d = bmax; d >= bmin; d -= 2) {
+			int32_t x = bd[d] > xoff ? bd[d] : xoff, y = x - d;
+			if (y < yoff) x = yoff + d, y = yoff;
+			if ((int64_t)x + y < bbest) bbest = (int64_t)x + y, bx = x;
+		}
+		if ((int64_t)xlim + ylim - bbest < fbest - ((int64_t)xoff + yoff)) {
+			*xmid = fx;
+			*ymid = fbest - fx;
+		} else {
+			*xmid = bx;
+			*ymid = bbest - bx;
+		}
+		return;
+	}
+}
+
+// Function to mark the lines of a[xoff, xlim) and b[yoff, ylim) that are
+// not part of a longest common subsequence
+void myers_compare(struct myers *diff, int32_t xoff, int32_t xlim, int32_t yoff, int32_t ylim) {
+	while (1) {
+		while (xoff < xlim && yoff < ylim && diff->a[xoff] == diff->b[yoff]) xoff++, yoff++;
+		while (xlim > xoff && ylim > yoff && diff->a[xlim - 1] == diff->b[ylim - 1]) xlim--, ylim--;
+		if (xoff == xlim) {
+			while (yoff < ylim) diff->changed_b[yoff++] = true;
+			return;
+		}
+		if (yoff == ylim) {
+			while (xoff < xlim) diff->changed_a[xoff++] = true;
+			return;
+		}
+		int32_t xmid, ymid;
+		myers_split(diff, xoff, xlim, yoff, ylim, &xmid, &ymid);
+		myers_compare(diff, xoff, xmid, yoff, ymid); // first half recursively, the second in this loop
+		xoff = xmid;
+		yoff = ymid;
+	}
+}
+
+// Function to print one line of a unified diff
+void print_diff_line(char mark, struct line_file *file, size_t i) {
+	const char *text = file->data + file->starts[i];
+	size_t len = file->starts[i + 1] - file->starts[i];
+	putchar(mark);
+	fwrite(text, 1, len, stdout);
+	if (len == 0 || text[len - 1] != '\n') printf("\n\\ No newline at end of file\n");
+}
+
+// Function to print the range of a hunk header, one-line ranges without a count
+void print_hunk_range(char mark, size_t start, size_t count) {
+	if (count == 1) printf("%c%zu", mark, start + 1);
+	else printf("%c%zu,%zu", mark, count ? start + 1 : start, count);
+}
+
+// hdiff -a: unified diff of two files. Lines are interned to ids, lines
+// found in only one file are marked right away, and Myers' O(ND) diff runs
+// on what is left in linear space.
+void hdiff_lines(const char *f_name1, const char *f_name2, int context) {
+	// stored fingerprints can tell identical files apart without reading them
+	struct stat st[2];
+	struct fingerprint_key keys[2];
+	struct block_fingerprint fps[2];
+	bool known[2] = {false, false}, regular[2] = {false, false}; // regular: st[f] is valid
+	const char *names[2] = {f_name1, f_name2};
+	for (int f = 0; f < 2; f++) {
+		regular[f] = stat(names[f], &st[f]) == 0 && S_ISREG(st[f].st_mode);
+		if (!regular[f]) continue;
+		keys[f] = fingerprint_key_of(&st[f]);
+		known[f] = fingerprint_load(&fps[f], &keys[f]);
+	}
+	bool same = known[0] && known[1] && fps[0].hash == fps[1].hash;
+	for (int f = 0; f < 2; f++) if (known[f]) free(fps[f].blocks);
+	if (same) {
+		printf("The two text files are identical\n");
+		return;
+	}
+
+	struct line_file files[2];
+	if (!line_file_load(&files[0], f_name1)) {
+		printf("File not found!\n");
+		return;
+	}
+	if (!line_file_load(&files[1], f_name2)) {
+		printf("File not found!\n");
+		line_file_free(&files[0]);
+		return;
+	}
+	if (files[0].count >= INT32_MAX / 2 || files[1].count >= INT32_MAX / 2) {
+		printf("Too many lines to compare\n");
+		line_file_free(&files[0]);
+		line_file_free(&files[1]);
+		return;
+	}
+	for (int f = 0; f < 2; f++) { // fingerprint what was read for the next run
+		struct fingerprint_key key;
+		if (known[f] || !regular[f] || !files[f].mapped) continue;
+		key = fingerprint_key_of(&st[f]);
+		if (key.size != files[f].size || !fingerprint_worth_saving(&key)) continue;
+		fingerprint_data(&fps[f], &key, (const uint8_t *)files[f].data);
+		fingerprint_save(&fps[f]);
+		free(fps[f].blocks);
+	}
+	uint32_t distinct = intern_lines(files);
+
+	// a line missing from the other file can only be a change
+	uint8_t *seen = calloc(distinct, 1); // bit f: the id occurs in file f
+	for (int f = 0; f < 2; f++)
+		for (size_t i = 0; i < files[f].count; i++) seen[files[f].ids[i]] |= 1 << f;
+	uint32_t *kept[2], *index[2];
+	int32_t kept_count[2] = {0, 0};
+	for (int f = 0; f < 2; f++) {
+		kept[f] = malloc(sizeof(uint32_t) * (files[f].count + 1));
+		index[f] = malloc(sizeof(uint32_t) * (files[f].count + 1));
+		for (size_t i = 0; i < files[f].count; i++) {
+			if (seen[files[f].ids[i]] == 3) {
+				kept[f][kept_count[f]] = files[f].ids[i];
+				index[f][kept_count[f]++] = i;
+			} else {
+				files[f].changed[i] = true;
+			}
+		}
 	}
-    
-	else if (regressionType == 2) { //polynomial regression
-    	// Constructing needed X matrix and Y vector.
-   	 double X[degree+1][degree+1];
-   	 for(int i=0; i<=degree; i++){
-   	 	for(int j=0; j<=degree; j++){
-   	     	X[i][j] = 0;
-   	     	for(int k=0; k<n; k++) {
-   	         	X[i][j] += pow(x[k], i+j);
-   	     	}
-   	 	}
-   	 }
+	free(seen);
 
-   	 double Y[degree + 1];
-   	 for(int i=0; i<=degree; i++){
-   	 	Y[i]=0;
-   	 	for(int k=0; k<n; k++){
-   	     	Y[i]+=pow(x[k], i)*y[k];
-   	 	}
-   	 }
-   	 
-   	 // Solve equations
-   	 for(int i=0; i<=degree; i++){
-   	 	for(int j=i+1; j<=degree; j++){
-   	     	double ratio=X[j][i]/X[i][i];
-   	     	for(int k=0; k<=degree; k++){
-   	         	X[j][k] -= ratio*X[i][k];
-   	     	}
-   	     	Y[j] -= ratio*Y[i];
-   	 	}
-   	 }
-   	 for(int i=degree; i>=0; i--){
-   	 	coefficients[i] = Y[i];
-   	 	for(int j=i+1; j<=degree; j++){
-   	     	coefficients[i] -= X[i][j]*coefficients[j];
-   	 	}
-   	 	coefficients[i]/=X[i][i];
-   	 }
-   	 
-    	printf("\nPolynomial Regression Coefficients:\n");
-    	for(int i = 0; i <= degree; i++){
-   	 printf("Coefficient a%d: %.2lf\n", i, coefficients[i]);
-   	 }
-	}else{
-    	printf("Invalid regression type!\n");
+	struct myers diff = {kept[0], kept[1], NULL, NULL, NULL, NULL, 4096};
+	int32_t n = kept_count[0], m = kept_count[1];
+	diff.changed_a = calloc(n + 1, sizeof(bool));
+	diff.changed_b = calloc(m + 1, sizeof(bool));
+	int32_t *diagonals = malloc(sizeof(int32_t) * 2 * ((size_t)n + m + 3));
+	diff.fd = diagonals + m + 1;
+	diff.bd = diagonals + (n + m + 3) + m + 1;
+	int32_t limit = 1;
+	for (int64_t d = (int64_t)n + m + 3; d != 0; d >>= 2) limit <<= 1; // about the square root of the size
+	if (limit > diff.too_expensive) diff.too_expensive = limit;
+	myers_compare(&diff, 0, n, 0, m);
+	for (int32_t i = 0; i < n; i++) if (diff.changed_a[i]) files[0].changed[index[0][i]] = true;
+	for (int32_t j = 0; j < m; j++) if (diff.changed_b[j]) files[1].changed[index[1][j]] = true;
+	free(diagonals);
+	free(diff.changed_a);
+	free(diff.changed_b);
+	for (int f = 0; f < 2; f++) {
+		free(kept[f]);
+		free(index[f]);
 	}
-    
-	FILE *datafile = fopen("data.txt", "w");
-	if(fp != NULL){
-    	for (int i = 0; i < n; i++){
-        	fprintf(datafile, "%lf %lf\n", x[i], y[i]);
-    	}
-    	fclose(datafile);
-	}else{
-    	fprintf(stderr, "Error: Unable to open file %s for writing\n", filename);
-	}   
-    
-	//Using gnuplot to plot
-    
-	FILE *gp = popen("gnuplot", "w");
-	if (gp != NULL) {
-    	fprintf(gp, "set terminal pngcairo enhanced font \"arial,10\" size 800,600\n"); //for appearence
-    	fprintf(gp, "set output \"plot.png\"\n");
-    	fprintf(gp, "set title \"Regression Plot\"\n");
-    	fprintf(gp, "set xlabel \"X\"\n");
-    	fprintf(gp, "set ylabel \"Y\"\n");
-    	fprintf(gp, "plot \"data.txt\" with points title \"Data Points\", ");
-    	if (regressionType == 1){
-        	fprintf(gp, "%f*x + %f with lines title \"Linear Regression\"\n", slope, intercept);
-    	}else{
-        	fprintf(gp, "%f", coefficients[0]);
-        	for (int i = 1; i <= degree; i++){
-            	fprintf(gp, " + %f*x**%d", coefficients[i], i);
-        	}
-        	fprintf(gp, " with lines title \"Polynomial Regression\"\n");
-    	}
-    	fprintf(gp, "quit\n");
-    	pclose(gp);
-	}else{
-    	fprintf(stderr, "Error: Unable to open Gnuplot\n");
+
+	// walk both files, grouping changes less than 2 * context lines apart into hunks
+	struct line_file *a = &files[0], *b = &files[1];
+	size_t i = 0, j = 0, removed = 0, added = 0;
+	bool header = false;
+	while (1) {
+		while (i < a->count && j < b->count && !a->changed[i] && !b->changed[j]) i++, j++;
+		if (i >= a->count && j >= b->count) break;
+		if (i >= a->count && !b->changed[j]) break; // cannot happen with a valid script
+		// find where this hunk ends: after the last change followed by 2 * context equal lines
+		size_t hi = i, hj = j, end_i = i, end_j = j;
+		while (1) {
+			while (hi < a->count && a->changed[hi]) hi++;
+			while (hj < b->count && b->changed[hj]) hj++;
+			end_i = hi;
+			end_j = hj;
+			size_t same = 0;
+			while (hi < a->count && hj < b->count && !a->changed[hi] && !b->changed[hj] && same <= 2 * (size_t)context)
+				hi++, hj++, same++;
+			bool more = (hi < a->count && a->changed[hi]) || (hj < b->count && b->changed[hj]);
+			if (!more || same > 2 * (size_t)context) break;
+		}
+		size_t before = i < (size_t)context ? i : (size_t)context; // context is equal in both files
+		size_t start_i = i - before, start_j = j - before;
+		size_t after_i = end_i + context < a->count ? end_i + context : a->count;
+		size_t after_j = end_j + context < b->count ? end_j + context : b->count;
+		size_t after = after_i - end_i < after_j - end_j ? after_i - end_i : after_j - end_j;
+		if (!header) {
+			printf("--- %s\n+++ %s\n", f_name1, f_name2);
+			header = true;
+		}
+		printf("@@ ");
+		print_hunk_range('-', start_i, end_i + after - start_i);
+		putchar(' ');
+		print_hunk_range('+', start_j, end_j + after - start_j);
+		printf(" @@\n");
+		for (size_t k = start_i; k < i; k++) print_diff_line(' ', a, k);
+		while (i < end_i || j < end_j) {
+			while (i < end_i && a->changed[i]) print_diff_line('-', a, i++), removed++;
+			while (j < end_j && b->changed[j]) print_diff_line('+', b, j++), added++;
+			while (i < end_i && j < end_j && !a->changed[i] && !b->changed[j]) print_diff_line(' ', a, i++), j++;
+		}
+		for (size_t k = 0; k < after; k++) print_diff_line(' ', a, i + k);
 	}
+	if (!header) printf("The two text files are identical\n");
+	line_file_free(&files[0]);
+	line_file_free(&files[1]);
 }
 
+// One file or directory found while walking a tree for hdiff -r
+struct tree_entry {
+	char *path; // relative to the root of the tree
+	mode_t mode;
+	off_t size;
+	struct timespec mtime;
+	dev_t dev;
+	ino_t ino;
+};
 
-void textify(struct command_t *command) {
-    if (command->arg_count<3) {
-        printf("You should enter: <filename> <mode(-count_letters, \
-        -count_words,-count_specific_word, -change_words)> [additional arguments]\n");
-        return;
-    }
-    const char *filename=command->args[1];
-    
-    //open file:
-    FILE *file = fopen(filename, "r");
-    if (!file) {
-        fprintf(stderr, "Error: Failed to open file\n");
-        return;
-    }
-    
-    //do what is needed according to mode
-    const char *mode=command->args[2];
-    
-    if (strcmp(mode, "-count_letters")==0) {
-        int count=0;
-		int c;
-		while ((c=fgetc(file)) != EOF) {
-		    if (isalpha(c)||isdigit(c)) count++;
+struct tree_list {
+	struct tree_entry *entries;
+	size_t count, capacity;
+};
+
+// Function to collect everything below root/relative, depth first
+void walk_tree(const char *root, const char *relative, struct tree_list *list) {
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s%s%s", root, *relative ? "/" : "", relative);
+	DIR *dir = opendir(path);
+	if (dir == NULL) {
+		fprintf(stderr, "hdiff: %s: %s\n", path, strerror(errno));
+		return;
+	}
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+		struct stat st;
+		if (fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1) continue;
+		if (list->count == list->capacity) {
+			list->capacity = list->capacity ? list->capacity * 2 : 256;
+			list->entries = realloc(list->entries, sizeof(struct tree_entry) * list->capacity);
 		}
-        printf("Number of letters in %s: %d\n", filename, count);
-        fclose(file);
-    } 
-    
-    else if (strcmp(mode, "-count_words") == 0) {
-		int count=0;
-		char word[100]; //max word length given as 100
-		while (fscanf(file, "%s", word)==1) {
-		    count++;
-		}
-		fclose(file);
-		printf("Number of words in %s: %d\n", filename, count);
-    } 
-    
-    else if (strcmp(mode, "-count_specific_word") == 0) {
-        if (command->arg_count < 4) {
-            printf("Do not forget to enter the word to look for as the third argument!\n");
-            return;
-        }
-        
-        const char *searched_word = command->args[3];
-        int count=0;
-		char word[100];
-		while (fscanf(file, "%s", word)==1) {
-		    if (strcmp(word, searched_word)==0) count++;
+		struct tree_entry *e = &list->entries[list->count++];
+		size_t len = strlen(relative) + strlen(entry->d_name) + 2;
+		e->path = malloc(len);
+		snprintf(e->path, len, "%s%s%s", relative, *relative ? "/" : "", entry->d_name);
+		e->mode = st.st_mode;
+		e->size = st.st_size;
+		e->mtime = st.st_mtim;
+		e->dev = st.st_dev;
+		e->ino = st.st_ino;
+		if (S_ISDIR(st.st_mode)) walk_tree(root, e->path, list); // may move list->entries
+	}
+	closedir(dir);
+}
+
+// Function to order paths component by component, so a directory is
+// directly followed by its contents
+int compare_tree_paths(const void *a, const void *b) {
+	const unsigned char *x = (const unsigned char *)((const struct tree_entry *)a)->path;
+	const unsigned char *y = (const unsigned char *)((const struct tree_entry *)b)->path;
+	while (*x && *x == *y) x++, y++;
+	int cx = *x == '/' ? 1 : *x, cy = *y == '/' ? 1 : *y;
+	return cx - cy;
+}
+
+// Content fingerprints of the files read in this run, keyed on what
+// identifies an unchanged file, so a file reached twice is read once
+struct fingerprint {
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	uint64_t hash;
+	bool used;
+};
+
+struct fingerprint_cache {
+	pthread_mutex_t lock;
+	struct fingerprint *slots;
+	size_t capacity, count;
+};
+
+size_t fingerprint_slot(struct fingerprint_cache *cache, struct tree_entry *e) {
+	uint64_t key[2] = {(uint64_t)e->dev, (uint64_t)e->ino};
+	size_t slot = xxh64(key, sizeof(key), 0) & (cache->capacity - 1);
+	while (cache->slots[slot].used && (cache->slots[slot].dev != e->dev || cache->slots[slot].ino != e->ino))
+		slot = (slot + 1) & (cache->capacity - 1);
+	return slot;
+}
+
+// Function to look up a file's fingerprint, false when it is unknown or stale
+bool fingerprint_lookup(struct fingerprint_cache *cache, struct tree_entry *e, uint64_t *hash) {
+	pthread_mutex_lock(&cache->lock);
+	if (cache->capacity == 0) {
+		pthread_mutex_unlock(&cache->lock);
+		return false;
+	}
+	struct fingerprint *f = &cache->slots[fingerprint_slot(cache, e)];
+	bool found = f->used && f->size == e->size && f->mtime.tv_sec == e->mtime.tv_sec && f->mtime.tv_nsec == e->mtime.tv_nsec;
+	if (found) *hash = f->hash;
+	pthread_mutex_unlock(&cache->lock);
+	return found;
+}
+
+void fingerprint_store(struct fingerprint_cache *cache, struct tree_entry *e, uint64_t hash) {
+	pthread_mutex_lock(&cache->lock);
+	if (cache->count * 2 >= cache->capacity) { // grow and rehash
+		struct fingerprint *old = cache->slots;
+		size_t old_capacity = cache->capacity;
+		cache->capacity = cache->capacity ? cache->capacity * 2 : 1024;
+		cache->slots = calloc(cache->capacity, sizeof(struct fingerprint));
+		for (size_t i = 0; i < old_capacity; i++) {
+			if (!old[i].used) continue;
+			struct tree_entry key = {.dev = old[i].dev, .ino = old[i].ino};
+			cache->slots[fingerprint_slot(cache, &key)] = old[i];
 		}
-		fclose(file);
-        printf("Number of occurrences of '%s' in %s: %d\n", searched_word, filename, count);
-    } 
-    
-    else if (strcmp(mode, "-change_words") == 0) {
-        if (command->arg_count < 5) {
-            printf("Do not forget to write the word that will be changed as the 3th, word to change to 4th argument\n");
-            return;
-        }
-        
-        const char *old_word = command->args[3];
-        const char *new_word = command->args[4];
-        
-        //To name the second file properly.
-		const char *dot_position = strrchr(filename, '.');
-		if (!dot_position) {
-		    fprintf(stderr, "Error: Invalid filename\n");
-		    fclose(file);
-		    return;
-		}
-		size_t filename_length = dot_position - filename;
-		char updated_filename[filename_length + strlen("-updated") + strlen(".txt") + 1];
-		strncpy(updated_filename, filename, filename_length); // Copy the filename without extension
-		updated_filename[filename_length] = '\0'; // Null-terminate the string
-		strcat(updated_filename, "-updated.txt"); // Append "-updated.txt"
-
-		//Opening new file:
-		FILE *updated_file = fopen(updated_filename, "w");
-		if (!updated_file) {
-		    fprintf(stderr, "Error: Failed to create updated file\n");
-		    fclose(file);
-		    return;
-		}
-
-		char word[100];
-		while (fscanf(file, "%s", word) == 1) {
-		    if (strcmp(word, old_word) == 0) {
-		        fprintf(updated_file, "%s ", new_word);
-		    } 
-		    else {
-		        fprintf(updated_file, "%s ", word);
-		    }
-
-		    int next_char = fgetc(file);
-		    ungetc(next_char, file); // Put back the character for further processing
-		    if (next_char == '\n' || next_char == EOF) {
-		        fprintf(updated_file, "\n"); // Add a newline character if it is
-		    }
-		}
-		fclose(file);
-		fclose(updated_file);
-        printf("Occurrences of '%s' in %s changed to '%s' in %s\n", old_word, filename,  new_word,updated_filename);
-        return;
-    } 
-    else {
-        fprintf(stderr, "That mode does not exist!\n");
-        return;
-    }
+		free(old);
+	}
+	struct fingerprint *f = &cache->slots[fingerprint_slot(cache, e)];
+	if (!f->used) cache->count++;
+	*f = (struct fingerprint){e->dev, e->ino, e->size, e->mtime, hash, true};
+	pthread_mutex_unlock(&cache->lock);
+}
+
+// Function to hash a file's content, from the caches when it is known
+bool file_fingerprint(struct fingerprint_cache *cache, const char *root, struct tree_entry *e, uint64_t *hash) {
+	if (fingerprint_lookup(cache, e, hash)) return true;
+	struct fingerprint_key key = {e->dev, e->ino, e->size, e->mtime.tv_sec, e->mtime.tv_nsec};
+	struct block_fingerprint fp;
+	if (fingerprint_load(&fp, &key)) {
+		*hash = fp.hash;
+		free(fp.blocks);
+		fingerprint_store(cache, e, *hash);
+		return true;
+	}
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%s", root, e->path);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) return false;
+	bool ok = true;
+	if (e->size <= 65536) { // small files are cheaper to read than to map
+		uint8_t buffer[65536];
+		ok = read_full(fd, buffer, e->size) == e->size;
+		if (ok) fingerprint_data(&fp, &key, buffer);
+	} else {
+		void *map = mmap(NULL, e->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			ok = false;
+		} else {
+			madvise(map, e->size, MADV_SEQUENTIAL);
+			fingerprint_data(&fp, &key, map);
+			munmap(map, e->size);
+			fingerprint_save(&fp);
+		}
+	}
+	if (ok) {
+		*hash = fp.hash;
+		free(fp.blocks);
+	}
+	close(fd);
+	if (ok) fingerprint_store(cache, e, *hash);
+	return ok;
+}
+
+// Pairs of same-sized files whose content has to be compared, shared by
+// the worker threads of hdiff -r
+struct tree_compare {
+	const char *roots[2];
+	struct tree_entry **pairs; // left and right entry of pair i at 2i and 2i + 1
+	int *verdicts; // 0 identical, 1 changed, -1 unreadable
+	size_t count;
+	size_t next; // next pair to take, atomic
+	struct fingerprint_cache cache;
+};
+
+void *tree_compare_worker(void *arg) {
+	struct tree_compare *work = arg;
+	size_t i;
+	while ((i = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED)) < work->count) {
+		struct tree_entry *left = work->pairs[2 * i], *right = work->pairs[2 * i + 1];
+		if (left->dev == right->dev && left->ino == right->ino) { // the same file
+			work->verdicts[i] = 0;
+			continue;
+		}
+		uint64_t a, b;
+		if (!file_fingerprint(&work->cache, work->roots[0], left, &a) ||
+			!file_fingerprint(&work->cache, work->roots[1], right, &b))
+			work->verdicts[i] = -1;
+		else
+			work->verdicts[i] = a != b;
+	}
+	return NULL;
+}
+
+// Function to tell whether two entries of the same path can differ
+// without reading them: -1 for undecided, else 0 or 1
+int tree_quick_check(const char *roots[2], struct tree_entry *left, struct tree_entry *right) {
+	if ((left->mode & S_IFMT) != (right->mode & S_IFMT)) return 1;
+	if (S_ISDIR(left->mode)) return 0;
+	if (S_ISLNK(left->mode)) { // compare the targets
+		char path[PATH_MAX], targets[2][PATH_MAX];
+		struct tree_entry *sides[2] = {left, right};
+		for (int s = 0; s < 2; s++) {
+			snprintf(path, sizeof(path), "%s/%s", roots[s], sides[s]->path);
+			ssize_t n = readlink(path, targets[s], sizeof(targets[s]) - 1);
+			targets[s][n < 0 ? 0 : n] = '\0';
+		}
+		return strcmp(targets[0], targets[1]) != 0;
+	}
+	if (!S_ISREG(left->mode)) return 0; // devices, fifos and sockets by type only
+	if (left->size != right->size) return 1;
+	if (left->mtime.tv_sec == right->mtime.tv_sec && left->mtime.tv_nsec == right->mtime.tv_nsec) return 0;
+	return -1;
+}
+
+// hdiff -r: compare two directory trees. Entries are matched by path;
+// files with equal size and mtime are taken as identical and the others
+// are fingerprinted on a thread pool. Prints added, removed and changed
+// paths in path order.
+void hdiff_trees(const char *root1, const char *root2, int threads) {
+	struct tree_list trees[2] = {{0}, {0}};
+	const char *roots[2] = {root1, root2};
+	for (int t = 0; t < 2; t++) {
+		struct stat st;
+		if (stat(roots[t], &st) == -1 || !S_ISDIR(st.st_mode)) {
+			printf("%s is not a directory\n", roots[t]);
+			return;
+		}
+		walk_tree(roots[t], "", &trees[t]);
+		qsort(trees[t].entries, trees[t].count, sizeof(struct tree_entry), compare_tree_paths);
+	}
+
+	// match the two sorted lists; -1 removed, 1 added, 2 changed, 0 same, 3 to read
+	size_t total = trees[0].count + trees[1].count;
+	struct tree_entry **lefts = malloc(sizeof(struct tree_entry *) * (total + 1));
+	struct tree_entry **rights = malloc(sizeof(struct tree_entry *) * (total + 1));
+	int *kinds = malloc(sizeof(int) * (total + 1));
+	size_t matched = 0, i = 0, j = 0;
+	struct tree_compare work = {.roots = {root1, root2}};
+	pthread_mutex_init(&work.cache.lock, NULL);
+	work.pairs = malloc(sizeof(struct tree_entry *) * 2 * (total + 1));
+	while (i < trees[0].count || j < trees[1].count) {
+		int order = i == trees[0].count ? 1 : j == trees[1].count ? -1 :
+					compare_tree_paths(&trees[0].entries[i], &trees[1].entries[j]);
+		struct tree_entry *left = order <= 0 ? &trees[0].entries[i++] : NULL;
+		struct tree_entry *right = order >= 0 ? &trees[1].entries[j++] : NULL;
+		int kind = left == NULL ? 1 : right == NULL ? -1 : tree_quick_check(roots, left, right);
+		if (kind == -1 && right) kind = 3; // undecided, read both
+		else if (kind == 1 && left && right) kind = 2;
+		if (kind == 3) {
+			work.pairs[2 * work.count] = left;
+			work.pairs[2 * work.count + 1] = right;
+			work.count++;
+		}
+		// an added or removed directory is reported once, without its contents
+		struct tree_entry *only = left ? (right ? NULL : left) : right;
+		if (only && S_ISDIR(only->mode)) {
+			struct tree_list *tree = left ? &trees[0] : &trees[1];
+			size_t *at = left ? &i : &j, len = strlen(only->path);
+			while (*at < tree->count && strncmp(tree->entries[*at].path, only->path, len) == 0 &&
+				   tree->entries[*at].path[len] == '/')
+				(*at)++;
+		}
+		lefts[matched] = left;
+		rights[matched] = right;
+		kinds[matched++] = kind;
+	}
+
+	if (fingerprint_store_enabled) hshell_cache_dir(); // set up before the workers share it
+	if (threads <= 0) threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads < 1) threads = 1;
+	if ((size_t)threads > work.count) threads = work.count ? work.count : 1;
+	work.verdicts = malloc(sizeof(int) * (work.count + 1));
+	pthread_t pool[threads];
+	int started = 0;
+	for (; started < threads - 1; started++)
+		if (pthread_create(&pool[started], NULL, tree_compare_worker, &work) != 0) break;
+	tree_compare_worker(&work); // this thread works too
+	for (int t = 0; t < started; t++) pthread_join(pool[t], NULL);
+
+	size_t added = 0, removed = 0, changed = 0, same = 0, unreadable = 0, next_pair = 0;
+	for (size_t k = 0; k < matched; k++) {
+		int kind = kinds[k];
+		if (kind == 3) { // read: 2 changed, 0 same, 4 could not be read
+			int verdict = work.verdicts[next_pair++];
+			kind = verdict < 0 ? 4 : verdict > 0 ? 2 : 0;
+		}
+		struct tree_entry *e = lefts[k] ? lefts[k] : rights[k];
+		const char *slash = S_ISDIR(e->mode) ? "/" : "";
+		if (kind == 1) printf("added: %s%s\n", e->path, slash), added++;
+		else if (kind == -1) printf("removed: %s%s\n", e->path, slash), removed++;
+		else if (kind == 2) printf("changed: %s%s\n", e->path, slash), changed++;
+		else if (kind == 4) printf("unreadable: %s\n", e->path), unreadable++;
+		else same++;
+	}
+	if (added + removed + changed + unreadable == 0) printf("The two directories are identical\n");
+	printf("%zu added, %zu removed, %zu changed, %zu identical, %zu unreadable (%zu compared by content)\n",
+		   added, removed, changed, same, unreadable, work.count);
+
+	for (int t = 0; t < 2; t++) {
+		for (size_t k = 0; k < trees[t].count; k++) free(trees[t].entries[k].path);
+		free(trees[t].entries);
+	}
+	free(lefts);
+	free(rights);
+	free(kinds);
+	free(work.pairs);
+	free(work.verdicts);
+	free(work.cache.slots);
+	pthread_mutex_destroy(&work.cache.lock);
+}
+
+// A file mapped read-only, or read into memory when it cannot be mapped
+struct mapped_file {
+	const uint8_t *data;
+	uint64_t size;
+	bool mapped;
+};
+
+bool map_file(struct mapped_file *file, const char *name) {
+	int fd = open(name, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) return false;
+	struct stat st;
+	memset(file, 0, sizeof(struct mapped_file));
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		file->size = st.st_size;
+		if (file->size == 0) {
+			close(fd);
+			return true;
+		}
+		void *map = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (map == MAP_FAILED) return false;
+		file->data = map;
+		file->mapped = true;
+		return true;
+	}
+	size_t capacity = 1 << 16; // pipes and the like
+	uint8_t *data = malloc(capacity);
+	ssize_t n;
+	while ((n = read_full(fd, data + file->size, capacity - file->size)) > 0) {
+		file->size += n;
+		if (file->size == capacity) data = realloc(data, capacity *= 2);
+	}
+	close(fd);
+	file->data = data;
+	return true;
+}
+
+void unmap_file(struct mapped_file *file) {
+	if (file->mapped) munmap((void *)file->data, file->size);
+	else free((void *)file->data);
+}
+
+// One step of the edit from the old file to the new one found by
+// hdiff -rolling: a copy of old bytes, or literal new bytes
+struct rolling_op {
+	bool copy;
+	uint64_t new_offset, old_offset, len;
+};
+
+struct rolling_ops {
+	struct rolling_op *ops;
+	size_t count, capacity;
+};
+
+// Function to append a step, merging it into the last one when they continue each other
+void rolling_add(struct rolling_ops *list, bool copy, uint64_t new_offset, uint64_t old_offset, uint64_t len) {
+	if (len == 0) return;
+	if (list->count > 0) {
+		struct rolling_op *last = &list->ops[list->count - 1];
+		if (last->copy == copy && last->new_offset + last->len == new_offset &&
+			(!copy || last->old_offset + last->len == old_offset)) {
+			last->len += len;
+			return;
+		}
+	}
+	if (list->count == list->capacity) {
+		list->capacity = list->capacity ? list->capacity * 2 : 64;
+		list->ops = realloc(list->ops, sizeof(struct rolling_op) * list->capacity);
+	}
+	list->ops[list->count++] = (struct rolling_op){copy, new_offset, old_offset, len};
+}
+
+int compare_op_old_offsets(const void *a, const void *b) {
+	uint64_t x = (*(struct rolling_op *const *)a)->old_offset, y = (*(struct rolling_op *const *)b)->old_offset;
+	return x < y ? -1 : x > y;
+}
+
+// Function to find the copies that keep their order: the chain of copies,
+// in new file order with rising old offsets, that covers the most bytes.
+// A Fenwick tree over the old offset ranks gives the best chain ending
+// below each offset in O(log n).
+bool *rolling_in_order(struct rolling_ops *list) {
+	size_t n = list->count;
+	bool *in_order = calloc(n + 1, sizeof(bool));
+	struct rolling_op **sorted = malloc(sizeof(struct rolling_op *) * (n + 1));
+	size_t copies = 0;
+	for (size_t i = 0; i < n; i++) if (list->ops[i].copy) sorted[copies++] = &list->ops[i];
+	qsort(sorted, copies, sizeof(struct rolling_op *), compare_op_old_offsets);
+	size_t *rank = malloc(sizeof(size_t) * (n + 1)); // 1-based rank of each copy's old offset
+	for (size_t r = 0, first = 0; r < copies; r++) {
+		if (r > 0 && sorted[r - 1]->old_offset != sorted[r]->old_offset) first = r;
+		rank[sorted[r] - list->ops] = first + 1; // equal offsets share the lowest rank, so neither extends the other
+	}
+	uint64_t *tree = calloc(copies + 1, sizeof(uint64_t)), *best = calloc(n + 1, sizeof(uint64_t));
+	size_t *tree_at = calloc(copies + 1, sizeof(size_t)), *previous = malloc(sizeof(size_t) * (n + 1));
+	size_t end = SIZE_MAX;
+	uint64_t end_weight = 0;
+	for (size_t i = 0; i < n; i++) {
+		if (!list->ops[i].copy) continue;
+		uint64_t before = 0;
+		previous[i] = SIZE_MAX;
+		for (size_t r = rank[i] - 1; r > 0; r -= r & -r) // best chain over lower offsets
+			if (tree[r] > before) before = tree[r], previous[i] = tree_at[r];
+		best[i] = before + list->ops[i].len;
+		for (size_t r = rank[i]; r <= copies; r += r & -r)
+			if (best[i] > tree[r]) tree[r] = best[i], tree_at[r] = i;
+		if (best[i] > end_weight) end_weight = best[i], end = i;
+	}
+	for (size_t i = end; i != SIZE_MAX; i = previous[i]) in_order[i] = true;
+	free(sorted);
+	free(rank);
+	free(tree);
+	free(best);
+	free(tree_at);
+	free(previous);
+	return in_order;
+}
+
+// rsync's weak checksum of a block: a is the byte sum, b the sum weighted
+// by distance from the end, both mod 2^16
+uint32_t weak_checksum(const uint8_t *p, size_t len) {
+	uint32_t a = 0, b = 0;
+	for (size_t i = 0; i < len; i++) {
+		a += p[i];
+		b += (uint32_t)(len - i) * p[i];
+	}
+	return (a & 0xffff) | (b << 16);
+}
+
+// hdiff -rolling: index the first (old) file by block with a weak rolling
+// checksum and a strong XXH64 hash, then find those blocks anywhere in the
+// second (new) file in one pass, as rsync does. Prints matched, moved,
+// inserted and deleted ranges and the size a delta would have.
+#define ROLLING_CHAIN_LIMIT 64 // candidate blocks tried per position
+
+// Function to pick the bucket of a weak checksum out of 2^bits. The top bits
+// of the product depend on every bit of w; the low bits would only see the
+// low bits of its byte sum half.
+size_t rolling_bucket(uint32_t w, int bits) {
+	return (size_t)(((uint64_t)w * 0x9E3779B97F4A7C15ULL) >> (64 - bits));
+}
+
+void hdiff_rolling(const char *f_name1, const char *f_name2, long block_size) {
+	struct mapped_file old, new;
+	if (!map_file(&old, f_name1)) {
+		printf("File not found!\n");
+		return;
+	}
+	if (!map_file(&new, f_name2)) {
+		printf("File not found!\n");
+		unmap_file(&old);
+		return;
+	}
+	uint64_t block = block_size;
+	if (block_size <= 0) { // rsync's choice: about the square root of the size
+		block = 700;
+		while (block * block < old.size && block < 131072) block += 8;
+	}
+	uint64_t blocks = old.size / block, tail = old.size % block;
+
+	// index: chains of blocks per weak checksum bucket
+	size_t capacity = 16;
+	int bits = 4;
+	while (capacity < blocks * 2) capacity *= 2, bits++;
+	int64_t *heads = malloc(sizeof(int64_t) * capacity), *chain = malloc(sizeof(int64_t) * (blocks + 1));
+	uint32_t *weak = malloc(sizeof(uint32_t) * (blocks + 1));
+	uint64_t *strong = malloc(sizeof(uint64_t) * (blocks + 1));
+	uint8_t *used = calloc(blocks / 8 + 1, 1);
+	for (size_t i = 0; i < capacity; i++) heads[i] = -1;
+	for (int64_t k = blocks - 1; k >= 0; k--) { // chains in file order
+		weak[k] = weak_checksum(old.data + k * block, block);
+		strong[k] = xxh64(old.data + k * block, block, 0);
+		size_t slot = rolling_bucket(weak[k], bits);
+		chain[k] = heads[slot];
+		heads[slot] = k;
+	}
+
+	// scan the new file, rolling the weak checksum a byte at a time
+	struct rolling_ops list = {0};
+	uint64_t pos = 0, literal = 0; // literal: start of the bytes not matched yet
+	int64_t expected = -1; // block after the last match, preferred on duplicates
+	uint32_t a = 0, b = 0;
+	bool fresh = true;
+	while (blocks > 0 && pos + block <= new.size) {
+		if (fresh) {
+			uint32_t w = weak_checksum(new.data + pos, block);
+			a = w & 0xffff;
+			b = w >> 16;
+			fresh = false;
+		}
+		uint32_t w = (a & 0xffff) | (b << 16);
+		// the block after the last match first, then the first match in the
+		// bucket; repeated blocks make long chains, so only a few are tried
+		int64_t found = -1;
+		bool hashed = false;
+		uint64_t hash = 0;
+		if (expected >= 0 && (uint64_t)expected < blocks && weak[expected] == w) {
+			hash = xxh64(new.data + pos, block, 0);
+			hashed = true;
+			if (strong[expected] == hash) found = expected;
+		}
+		int steps = 0;
+		for (int64_t k = heads[rolling_bucket(w, bits)]; found == -1 && k != -1 && steps < ROLLING_CHAIN_LIMIT;
+			 k = chain[k], steps++) {
+			if (weak[k] != w) continue;
+			if (!hashed) hash = xxh64(new.data + pos, block, 0), hashed = true;
+			if (strong[k] == hash) found = k;
+		}
+		if (found != -1) {
+			rolling_add(&list, false, literal, 0, pos - literal);
+			rolling_add(&list, true, pos, found * block, block);
+			used[found / 8] |= 1 << (found % 8);
+			expected = found + 1;
+			pos += block;
+			literal = pos;
+			fresh = true;
+			continue;
+		}
+		if (pos + block >= new.size) break;
+		uint8_t out = new.data[pos], in = new.data[pos + block];
+		a = (a - out + in) & 0xffff;
+		b = (b - block * out + a) & 0xffff;
+		pos++;
+	}
+	// the old file's last partial block can only be found at the very end
+	bool tail_used = false;
+	if (tail > 0 && new.size - literal >= tail &&
+		memcmp(new.data + new.size - tail, old.data + old.size - tail, tail) == 0) {
+		rolling_add(&list, false, literal, 0, new.size - tail - literal);
+		rolling_add(&list, true, new.size - tail, old.size - tail, tail);
+		tail_used = true;
+	} else {
+		rolling_add(&list, false, literal, 0, new.size - literal);
+	}
+
+	// report in new file order; copies outside the heaviest in-order chain are moves
+	bool *in_order = rolling_in_order(&list);
+	uint64_t matched = 0, moved = 0, inserted = 0, deleted = 0, delta = 0;
+	for (size_t i = 0; i < list.count; i++) {
+		struct rolling_op *op = &list.ops[i];
+		if (!op->copy) {
+			printf("inserted new %" PRIu64 "-%" PRIu64 " (%" PRIu64 " bytes)\n",
+				   op->new_offset, op->new_offset + op->len - 1, op->len);
+			inserted += op->len;
+			delta += op->len + 5; // bytes plus an instruction header
+			continue;
+		}
+		printf("%-8s old %" PRIu64 "-%" PRIu64 " new %" PRIu64 "-%" PRIu64 " (%" PRIu64 " bytes)\n",
+			   in_order[i] ? "matched" : "moved", op->old_offset, op->old_offset + op->len - 1,
+			   op->new_offset, op->new_offset + op->len - 1, op->len);
+		if (in_order[i]) matched += op->len;
+		else moved += op->len;
+		delta += 9; // offset and length of the copy
+	}
+	uint64_t units = blocks + (tail > 0); // the partial tail is the last unit
+	for (uint64_t k = 0; k < units; k++) { // old ranges nothing was copied from
+		if (k < blocks ? (used[k / 8] >> (k % 8)) & 1 : tail_used) continue;
+		uint64_t start = k;
+		while (k + 1 < units && !(k + 1 < blocks ? (used[(k + 1) / 8] >> ((k + 1) % 8)) & 1 : tail_used)) k++;
+		uint64_t from = start * block, to = (k + 1) * block < old.size ? (k + 1) * block : old.size;
+		printf("deleted  old %" PRIu64 "-%" PRIu64 " (%" PRIu64 " bytes)\n", from, to - 1, to - from);
+		deleted += to - from;
+	}
+	printf("block %" PRIu64 ": %" PRIu64 " bytes matched, %" PRIu64 " moved, %" PRIu64 " inserted, %" PRIu64
+		   " deleted; estimated delta %" PRIu64 " bytes (%.1f%% of %s)\n",
+		   block, matched, moved, inserted, deleted, delta, new.size ? 100.0 * delta / new.size : 0.0, f_name2);
+
+	free(in_order);
+	free(list.ops);
+	free(heads);
+	free(chain);
+	free(weak);
+	free(strong);
+	free(used);
+	unmap_file(&old);
+	unmap_file(&new);
 }
 
 void hdiff(struct command_t *command){
     char* f_name1;
     char* f_name2;
     int mode_flag=0;
+    int context=3; //lines of context around each change
+    int threads=0; //workers for -r, 0 means one per core
+    long block_size=0; //block for -rolling, 0 picks one from the file size
+    bool use_cache=true; //stored file fingerprints
+    struct byte_compare compare = {0};
     
-    //Read from command:
-    if(command->arg_count==4){
-   	 f_name1=command->args[1];
-   	 f_name2=command->args[2];
-    }else if(command->arg_count==5){
-   	 f_name1=command->args[2];
-   	 f_name2=command->args[3];
-   	 if (strcmp(command->args[1], "-b")==0){
+    //Read from command: options first, then the two files
+    int first_file=1;
+    for(; first_file<command->arg_count-1 && command->args[first_file][0]=='-'; first_file++){
+   	 const char *option=command->args[first_file];
+   	 if(strcmp(option, "-a")==0){
+   		 mode_flag=0;
+   	 }else if(strcmp(option, "-U")==0 && first_file+1<command->arg_count-1){
+   		 context=atoi(command->args[++first_file]);
+   		 if(context<0) context=0;
+   	 }else if(strcmp(option, "-j")==0 && first_file+1<command->arg_count-1){
+   		 threads=atoi(command->args[++first_file]);
+   	 }else if(strcmp(option, "-r")==0){ //compare two directory trees
+   		 mode_flag=2;
+   	 }else if(strcmp(option, "-rolling")==0){ //match blocks wherever they moved
+   		 mode_flag=3;
+   	 }else if(strcmp(option, "-block")==0 && first_file+1<command->arg_count-1){
+   		 mode_flag=3;
+   		 block_size=atol(command->args[++first_file]);
+   	 }else if(strcmp(option, "-nocache")==0){ //neither use nor keep stored fingerprints
+   		 use_cache=false;
+   	 }else if(strcmp(option, "-b")==0){
+   		 mode_flag=1;
+   	 }else if(strcmp(option, "-ranges")==0){ //list the differing byte ranges
+   		 mode_flag=1;
+   		 compare.ranges=true;
+   	 }else if(strcmp(option, "-bits")==0){ //count differing bits instead of bytes
    		 mode_flag=1;
+   		 compare.bits=true;
+   	 }else{
+   		 printf("Unknown option %s\n", option);
+   		 return;
    	 }
-    }else{
+    }
+    if(command->arg_count-1-first_file!=2){
    	 printf("Number of arguments are not correct\n");
    	 return;
     }
-    
-    //open files
-    FILE *file1=fopen(f_name1, "r");
-    FILE *file2=fopen(f_name2, "r");
-    
-    if(file1==NULL || file2==NULL){
-    	printf("File not found!\n");
-    }
-    
-    //get the extenisons  of the files:
-    char *extension1=NULL;
-    char *extension2=NULL;
-    //First file:
-    char *token1=strtok(f_name1, ".");
-    while(token1!=NULL){
-   	 extension1=token1;
-   	 token1= strtok(NULL,".");
-    }
-    //Second file:
-    char *token2=strtok(f_name2, ".");
-    while(token2!=NULL){
-   	 extension2=token2;
-   	 token2=strtok(NULL, ".");
-    }
-    
-    //Now, compare.
-    if(mode_flag==0){ //mode -a, txt file compare
-      	 //Necessary checks:
-      	 if(extension1==NULL || extension2 ==NULL){
-      		 printf("Extension could not be found for at least one of the files!\n");
-      		 return;
-      	 }else if(strcmp(extension1, "txt")==1|| strcmp(extension2, "txt")==1){
-      		 printf("At least one of the files not txt!\n");
-      		 return;
-   	 }
-      	 
-   	 int differenceNum=0;
-   	 int lineNum=1;
-   	 
-   	 char *line1=NULL;
-   	 size_t size1=0;
-   	 ssize_t line_len1=0;
-   	 
-   	 char *line2=NULL;
-   	 size_t size2=0;
-   	 ssize_t line_len2=0;
-   	 //flags to check if files are finished:
-   	 int f1=0;
-   	 int f2=0;
-      	 
-   	 while(true){
-   		 line_len1=getline(&line1, &size1, file1);
-   		 if(line_len1==-1){f1=1;}
-   		 line_len2=getline(&line2, &size2, file2);
-   		 if(line_len2==-1){f2=1;}
-   		 if(f1 && f2){ //both files finished
-   			 break;
-   		 }
-   		 if(strcmp(line1, line2)){ //if linea are different
-   			 differenceNum++;
-   			 printf("%s: Line %d: %s",f_name1, lineNum, line1);
-   			 printf("%s: Line %d: %s",f_name2, lineNum, line2);
-   		 }
-   		 lineNum++;
-   	 }
-      	 if(differenceNum==0)printf("The two text files are identical\n");
-   	 else printf("%d different lines found\n", differenceNum);
+    f_name1=command->args[first_file];
+    f_name2=command->args[first_file+1];
+    fingerprint_store_enabled=use_cache;
+    fingerprints_saved=0;
+    if(mode_flag==1){ //mode -b, comparing byte by byte
+   	 hdiff_bytes(f_name1, f_name2, &compare);
+    }else if(mode_flag==2){ //mode -r, two directory trees
+   	 hdiff_trees(f_name1, f_name2, threads);
+    }else if(mode_flag==3){ //mode -rolling, rsync style block matching
+   	 hdiff_rolling(f_name1, f_name2, block_size);
+    }else{
+   	 hdiff_lines(f_name1, f_name2, context); //mode -a, line by line
     }
-    
-    else{//mode -b, comparing bit by bit:
-   	 //getting the length of each file
-   	 fseek(file1, 0, SEEK_END);
-   	 long len1 = ftell(file1);
-   	 rewind(file1);
-
-   	 fseek(file2, 0, SEEK_END);
-   	 long len2 = ftell(file2);    
-   	 rewind(file2);
-
-   	 int min_len=0;
-   	 if(len1>len2){
-   		 min_len=len2;
-   	 }else{
-   		 min_len=len1;  	 
-   	 }
-  	 
-   	 //allocating memory
-   	 char *buffer1 = (char*)calloc((len1),1);
-   	 char *buffer2 = (char*)calloc((len2), 1);
-   	 int differenceNum=0;
-   	 int i=0;
-  	      while(i<min_len){ //read bit by bit until end of the shorter file
-  	     	 fread(buffer1+i,1,1,file1);
-  			 fread(buffer2+i,1,1,file2);
-  			 if(buffer1[i]!=buffer2[i]){
-  				 differenceNum++;
-  			 }
-  			 i++;  
-   	 }
-   	 //free memory
-   	 free(buffer1);
-   	 free(buffer2);       
-   	 differenceNum+=(-2*min_len)+len1+len2; //add the difference in length to difference also
-  	 
-   	 if(differenceNum==0){
-   		 printf("The two files are identical\n");
-   	 }else {
-   		 printf("The two files are different in %d bytes\n", differenceNum);    
-   	 }
-    }		   	 
+    if(fingerprints_saved>0) fingerprint_prune(); //the store only grows when something was saved
 }